@@ -0,0 +1,8 @@
+10 REM Reading a table from DATA, again and again
+20 FOR R = 1 TO 200000
+30 RESTORE
+40 FOR I = 1 TO 10 : READ N$, V : T = T + V : NEXT I
+50 NEXT R
+60 PRINT T
+100 DATA ALPHA, 1, BRAVO, 2, CHARLIE, 3, DELTA, 4, ECHO, 5
+110 DATA FOXTROT, 6, GOLF, 7, HOTEL, 8, INDIA, 9, JULIETT, 10
@@ -0,0 +1,7 @@
+10 REM Tight numeric FOR loops
+20 S = 0
+30 FOR I = 1 TO 2000000
+40 S = S + I * 2 - 1
+50 NEXT I
+60 FOR J = 1 TO 1000 : FOR K = 1 TO 1000 : T = T + K : NEXT K : NEXT J
+70 PRINT S, T
@@ -0,0 +1,12 @@
+10 REM Recursive Fibonacci through GOSUB, with an explicit argument stack
+20 DIM K(100)
+30 FOR R = 1 TO 20
+40 P = 0 : K(0) = 20 : F = 0
+50 GOSUB 100
+60 NEXT R
+70 PRINT F
+80 END
+100 IF K(P) < 2 THEN F = F + K(P) : RETURN
+110 K(P + 1) = K(P) - 1 : P = P + 1 : GOSUB 100 : P = P - 1
+120 K(P + 1) = K(P) - 2 : P = P + 1 : GOSUB 100 : P = P - 1
+130 RETURN
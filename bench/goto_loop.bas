@@ -0,0 +1,6 @@
+10 REM A loop built from IF and GOTO
+20 I = 0 : S = 0
+30 I = I + 1
+40 S = S + I
+50 IF I < 2000000 THEN GOTO 30
+60 PRINT S
@@ -0,0 +1,221 @@
+#include "cbsh.h"
+
+// Microbenchmarks of the interpreter's front end and core lookups, at a few
+// realistic program sizes. Each benchmark repeats its operation in batches
+// until it has run for at least MIN_SECONDS, then prints one JSON object per
+// line: {"suite", "benchmark", "size", "ops", "seconds", "ops_per_sec",
+// "ns_per_op"}. Built and run by `make bench` (bench/run.sh).
+
+#define MIN_SECONDS 0.25
+
+// Monotonic time in seconds
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Print one result
+static void report(const char *benchmark, int size, long long ops, double seconds) {
+    printf("{\"suite\": \"micro\", \"benchmark\": \"%s\", \"size\": %d, \"ops\": %lld, \"seconds\": %.6f, "
+           "\"ops_per_sec\": %.1f, \"ns_per_op\": %.2f}\n",
+           benchmark, size, ops, seconds, ops / seconds, seconds * 1e9 / ops);
+    fflush(stdout);
+}
+
+// Text of line i of a synthetic program: a mix of the statements real programs use
+static void programLine(int i, char *buffer, size_t size) {
+    int number = (i + 1) * 10;
+    switch (i % 6) {
+        case 0:
+            snprintf(buffer, size, "%d LET A%d = B%d * 2 + SQR(C) - D / 3", number, i % 50, (i + 7) % 50);
+            break;
+        case 1:
+            snprintf(buffer, size, "%d IF X > %d THEN GOSUB %d", number, i, number + 20);
+            break;
+        case 2:
+            snprintf(buffer, size, "%d PRINT \"TOTAL: \"; T; \" OF \"; N, A$", number);
+            break;
+        case 3:
+            snprintf(buffer, size, "%d FOR I = 1 TO 100 STEP 2 : S = S + I : NEXT I", number);
+            break;
+        case 4:
+            snprintf(buffer, size, "%d A$ = LEFT$(B$, 3) + MID$(C$, 2, 4) : REM build the name", number);
+            break;
+        default:
+            snprintf(buffer, size, "%d DATA %d, 3.25, \"ITEM %d\", -7", number, i, i);
+            break;
+    }
+}
+
+// Source text of a synthetic program of n lines
+static char **programText(int n) {
+    char **lines = malloc(n * sizeof(char *));
+    char buffer[MAX_LINE_LENGTH];
+    for (int i = 0; i < n; i++) {
+        programLine(i, buffer, sizeof(buffer));
+        lines[i] = strdup(buffer);
+    }
+    return lines;
+}
+
+static void freeProgramText(char **lines, int n) {
+    for (int i = 0; i < n; i++) {
+        free(lines[i]);
+    }
+    free(lines);
+}
+
+// tokenizeLine(): one op is one line lexed into tokens and statements
+static void benchTokenizeLine(int n) {
+    char **lines = programText(n);
+    long long ops = 0;
+    double start = now();
+    double elapsed;
+    do {
+        for (int i = 0; i < n; i++) {
+            Line line;
+            tokenizeLine(lines[i], &line);
+            freeLine(&line);
+        }
+        ops += n;
+    } while ((elapsed = now() - start) < MIN_SECONDS);
+    report("tokenizeLine", n, ops, elapsed);
+    freeProgramText(lines, n);
+}
+
+// getNextToken(): one op is one token scanned
+static void benchGetNextToken(int n) {
+    char **lines = programText(n);
+    long long ops = 0;
+    double start = now();
+    double elapsed;
+    do {
+        for (int i = 0; i < n; i++) {
+            int pos = 0;
+            for (;;) {
+                TokenType type = getNextToken(lines[i], &pos).type;
+                if (type == TOKEN_NEWLINE || type == TOKEN_EOF) {
+                    break;
+                }
+                ops++;
+            }
+        }
+    } while ((elapsed = now() - start) < MIN_SECONDS);
+    report("getNextToken", n, ops, elapsed);
+    freeProgramText(lines, n);
+}
+
+// addLine(): one op is one line inserted, in a shuffled order, into a
+// program that grows to n lines
+static void benchAddLine(int n) {
+    char **lines = programText(n);
+    int *order = malloc(n * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        order[i] = i;
+    }
+    srand(12345);
+    for (int i = n - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        int t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+
+    // Lexing is measured on its own above, so tokenize each round up front
+    Line *tokenized = malloc(n * sizeof(Line));
+    long long ops = 0;
+    double elapsed = 0;
+    do {
+        for (int i = 0; i < n; i++) {
+            tokenizeLine(lines[order[i]], &tokenized[i]);
+        }
+        double start = now();
+        for (int i = 0; i < n; i++) {
+            addLine(&tokenized[i]);
+        }
+        elapsed += now() - start;
+        ops += n;
+        executeNew();
+    } while (elapsed < MIN_SECONDS);
+    report("addLine", n, ops, elapsed);
+    free(tokenized);
+    free(order);
+    freeProgramText(lines, n);
+}
+
+// findVariableSlot() (what findVariable was): one op is one lookup by name
+// in a table of n variables
+static void benchFindVariable(int n) {
+    char (*names)[16] = malloc(n * sizeof(*names));
+    for (int i = 0; i < n; i++) {
+        snprintf(names[i], sizeof(names[i]), i % 3 == 0 ? "V%d$" : "V%d", i);
+        getVariableSlot(names[i]);
+    }
+    long long ops = 0;
+    int found = 0;
+    double start = now();
+    double elapsed;
+    do {
+        for (int i = 0; i < n; i++) {
+            found += findVariableSlot(names[(i * 7) % n]) >= 0;
+        }
+        ops += n;
+    } while ((elapsed = now() - start) < MIN_SECONDS);
+    if (found != ops) {
+        fprintf(stderr, "findVariableSlot missed a variable\n");
+    }
+    report("findVariable", n, ops, elapsed);
+    executeNew();
+    free(names);
+}
+
+// evaluateExpression(): one op is one evaluation of an expression of the
+// given number of tokens (compiled on first use, as in a running program)
+static void benchEvaluateExpression(const char *text) {
+    Line line;
+    tokenizeLine(text, &line);
+    prepareLine(&line);
+    addOrUpdateVariable("A", VAR_TYPE_NUMERIC, 3, NULL);
+    addOrUpdateVariable("B", VAR_TYPE_NUMERIC, 4, NULL);
+    addOrUpdateVariable("C", VAR_TYPE_NUMERIC, 16, NULL);
+    addOrUpdateVariable("D", VAR_TYPE_NUMERIC, 5, NULL);
+    long long ops = 0;
+    double sum = 0;
+    double start = now();
+    double elapsed;
+    do {
+        for (int i = 0; i < 1000; i++) {
+            sum += evaluateExpression(line.tokens, line.numTokens);
+        }
+        ops += 1000;
+    } while ((elapsed = now() - start) < MIN_SECONDS);
+    if (sum == 0) {
+        fprintf(stderr, "evaluateExpression gave 0 for %s\n", text);
+    }
+    report("evaluateExpression", line.numTokens, ops, elapsed);
+    freeLine(&line);
+    executeNew();
+}
+
+int main() {
+    initOutput();
+    static const int sizes[] = {100, 1000, 10000};
+    for (int i = 0; i < 3; i++) {
+        benchTokenizeLine(sizes[i]);
+    }
+    for (int i = 0; i < 3; i++) {
+        benchGetNextToken(sizes[i]);
+    }
+    for (int i = 0; i < 3; i++) {
+        benchAddLine(sizes[i]);
+    }
+    static const int variableCounts[] = {10, 100, 1000};
+    for (int i = 0; i < 3; i++) {
+        benchFindVariable(variableCounts[i]);
+    }
+    benchEvaluateExpression("A + 1");
+    benchEvaluateExpression("A * B + SQR(C) - D / 2");
+    benchEvaluateExpression("(A + B) * (C - D) / (A + 1) ^ 2 + INT(C / 3) * SGN(D - B) - ABS(A - C)");
+    return 0;
+}
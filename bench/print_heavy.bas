@@ -0,0 +1,5 @@
+10 REM Heavy PRINT output: numbers, strings and PRINT USING
+20 FOR I = 1 TO 200000
+30 PRINT I; "SQUARED IS"; I * I, I / 7
+40 PRINT USING "###,###.##"; I * 1.5
+50 NEXT I
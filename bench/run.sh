@@ -0,0 +1,42 @@
+#!/bin/sh
+# Run the benchmarks: the BASIC workloads in this directory, then the C
+# microbenchmarks. Every result is one JSON object per line on stdout.
+#
+#   run.sh CBSH MICROBENCH BENCHDIR
+#
+# A workload's statement count comes from a profiled run (cbsh --profile);
+# its time is the best of BENCH_RUNS (default 3) plain runs.
+
+cbsh=$1
+microbench=$2
+benchdir=$3
+runs=${BENCH_RUNS:-3}
+
+CBSH_NO_IMAGE_CACHE=1
+export CBSH_NO_IMAGE_CACHE
+
+for script in "$benchdir"/*.bas; do
+    name=$(basename "$script" .bas)
+    statements=$("$cbsh" --profile "$script" 2>&1 >/dev/null | sed -n 's/^Profile: \([0-9]*\) statements.*/\1/p')
+    if [ -z "$statements" ]; then
+        echo "$name: no profile from $cbsh" >&2
+        exit 1
+    fi
+    best=
+    i=0
+    while [ $i -lt "$runs" ]; do
+        start=$(date +%s%N)
+        "$cbsh" "$script" >/dev/null || exit 1
+        ns=$(($(date +%s%N) - start))
+        if [ -z "$best" ] || [ "$ns" -lt "$best" ]; then
+            best=$ns
+        fi
+        i=$((i + 1))
+    done
+    awk -v name="$name" -v statements="$statements" -v ns="$best" 'BEGIN {
+        printf "{\"suite\": \"basic\", \"benchmark\": \"%s\", \"statements\": %d, \"seconds\": %.6f, ", name, statements, ns / 1e9
+        printf "\"ops_per_sec\": %.1f, \"ns_per_statement\": %.2f}\n", statements / (ns / 1e9), ns / statements
+    }'
+done
+
+"$microbench"
@@ -0,0 +1,10 @@
+10 REM Building, slicing and searching strings
+20 FOR R = 1 TO 20
+30 S$ = ""
+40 FOR I = 1 TO 20000
+50 S$ = S$ + "AB" + LEFT$("XYZ", I - INT(I / 3) * 3)
+60 NEXT I
+70 N = N + LEN(S$) + INSTR(S$, "ABXYAB")
+80 T$ = MID$(S$, 1000, 50) + RIGHT$(S$, 10)
+90 NEXT R
+100 PRINT N, LEN(T$)
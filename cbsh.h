@@ -7,17 +7,25 @@
 #include <math.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <limits.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <sys/wait.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/resource.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include "config.h"
 
 #define MAX_LINE_LENGTH 256
-#define MAX_NUM_LINES 1000
-#define MAX_VARIABLES 100
-#define MAX_DATA_VALUES 1000
+#define NUMBER_BUFFER_SIZE 32 // Longest number formatNumber() produces
 
 // Token types
 typedef enum {
@@ -37,97 +45,363 @@ typedef enum {
     KW_SQR, KW_RND, KW_SIN, KW_LET, KW_USR, KW_DATA, KW_READ, KW_REM,
     KW_CLEAR, KW_STOP, KW_TAB, KW_RESTORE, KW_ABS, KW_END, KW_INT,
     KW_RETURN, KW_STEP, KW_GOTO, KW_GOSUB, KW_SET, KW_TO, KW_RUN, KW_NONE,
-    KW_LOAD, KW_DIR, KW_ADD, KW_SUB, KW_DIV, KW_FLOOR
+    KW_LOAD, KW_DIR, KW_ADD, KW_SUB, KW_DIV, KW_FLOOR, KW_AND, KW_OR, KW_NOT, KW_ON, KW_USING, KW_SAVE, KW_DIM,
+    KW_MAT, KW_SUM, KW_DOT, KW_LEN, KW_LEFT, KW_RIGHT, KW_MID, KW_INSTR,
+    KW_COS, KW_ATN, KW_EXP, KW_LOG, KW_SGN, KW_STATS, KW_JOBS, KW_WAIT,
+    KW_COUNT // Number of keywords; new ones go before it
 } Keyword;
 
 // A structure to represent a token
 typedef struct {
     TokenType type;
     Keyword keyword; // If it's a keyword
-    char value[MAX_LINE_LENGTH]; // Store number, string, identifier, etc.
+    const char *value; // Interned text of the number, string, identifier, etc.
+    int target; // Cached program index of a GOTO/GOSUB target line, or of the NEXT paired with a FOR
+    unsigned int targetGeneration; // programGeneration the cached target belongs to
+    int slot; // Resolved variable slot of an identifier, or -1
+    struct Expr *expr; // Compiled expression starting at this token, if any
+    struct UsingFormat *format; // Compiled PRINT USING format, on the USING token
+    double number; // Value of a TOKEN_NUMBER, parsed once by the lexer
+    int integer; // The same value as an int, when isInteger
+    bool isInteger; // number is integral and fits in an int (line numbers, targets)
 } Token;
 
 // A structure to represent a program line
 typedef struct {
     int lineNumber;
-    Token tokens[MAX_LINE_LENGTH]; // Array of tokens for this line
     int numTokens;
+    Token *tokens; // Heap array of exactly numTokens tokens
+    int numStatements;
+    int *statements; // Token index each colon-separated statement starts at, plus numTokens + 1
 } Line;
 
 // Variable data types
 typedef enum {
     VAR_TYPE_NUMERIC,
-    VAR_TYPE_STRING
+    VAR_TYPE_STRING,
+    VAR_TYPE_INTEGER // Variables and arrays named with %; values are numeric
 } VarType;
 
-// A structure to represent a variable
+// A string: a length and its bytes, which are not NUL-terminated. Short
+// strings are stored inline; longer ones are a slice of a reference-counted
+// heap buffer, or point at interned text (stringheap.c).
+#define SMALL_STRING 15
+typedef struct StringBuffer StringBuffer;
 typedef struct {
-    char name[MAX_LINE_LENGTH];
+    int length;
+    StringBuffer *buffer; // Buffer this is a slice of (holding a reference), or NULL
+    union {
+        char inlined[SMALL_STRING + 1]; // No buffer and length <= SMALL_STRING
+        const char *chars; // Otherwise
+    } data;
+} String;
+
+// The bytes of a string
+static inline const char *stringChars(const String *s) {
+    return s->buffer || s->length > SMALL_STRING ? s->data.chars : s->data.inlined;
+}
+
+// The elements of an array, stored contiguously in row-major order
+#define MAX_DIMENSIONS 8
+typedef struct {
+    int numDims;
+    int extents[MAX_DIMENSIONS]; // Highest subscript + 1, per dimension
+    int size; // Number of elements
+    double *numbers; // Numeric arrays
+    int64_t *integers; // Integer arrays
+    String *strings; // String arrays
+} Array;
+
+// The rarely touched part of a variable. Values live in the parallel
+// numValues, intValues and strValues arrays, indexed by the same slot.
+typedef struct {
+    const char *name; // Interned, upper-cased; arrays are "NAME(", apart from scalars
     VarType type;
-    double numValue; // Store numeric values
-    char strValue[MAX_LINE_LENGTH]; // Store string values
+    Array *array; // Elements of an array, NULL until it is dimensioned
+} VariableInfo;
+
+// Storage an assignment writes to: a variable or an array element
+typedef struct {
+    VarType type;
+    double *num; // Numeric targets
+    int64_t *integer; // Integer targets
+    String *str; // String targets
+} Target;
+
+// A runtime value produced by an expression
+typedef struct {
+    VarType type;
+    bool owned; // str holds a reference of its own, which the receiver must store or release
+    double num;
+    String str; // Unless owned, borrowed from a literal or variable; valid until it changes
+} Value;
+
+// Operations of a compiled expression, in postfix order
+typedef enum {
+    OP_NUMBER, OP_STRING, OP_VARIABLE, OP_INTEGER_VARIABLE, OP_STRING_VARIABLE, OP_ELEMENT, OP_SUM, OP_DOT,
+    OP_LEN, OP_LEFT, OP_RIGHT, OP_MID, OP_INSTR, OP_MATH,
+    OP_NEGATE, OP_NOT,
+    OP_ADD, OP_SUBTRACT, OP_MULTIPLY, OP_DIVIDE, OP_POWER,
+    OP_EQUAL, OP_NOT_EQUAL, OP_LESS, OP_GREATER, OP_LESS_EQUAL, OP_GREATER_EQUAL,
+    OP_AND, OP_OR
+} ExprOp;
+
+typedef struct {
+    ExprOp op;
+    int slot; // Variable ops, OP_ELEMENT, OP_SUM, OP_DOT
+    int count; // OP_ELEMENT: subscripts on the stack; function calls: arguments
+    int other; // OP_DOT: slot of the second array
+    double number; // OP_NUMBER
+    const char *string; // OP_STRING (count is its length); OP_MATH: the function's name
+    double (*math)(double); // OP_MATH: the intrinsic, resolved when compiling
+} ExprInstr;
+
+// An expression compiled once from a token span and cached on its first token
+typedef struct Expr {
+    int numTokens; // Length of the span it was compiled from
+    int consumed; // Tokens actually making up the expression (a prefix of the span)
+    unsigned int symbolGeneration; // Slots are only valid for this generation
+    int maxDepth; // Evaluation stack needed
+    int length;
+    ExprInstr code[];
+} Expr;
+
+// A DATA item. Whether it is a number is only known from its text, so
+// READ decides: a numeric variable needs a number, a string gets the text.
+typedef struct {
+    const char *text; // Interned
+    int length;
+    double number;
+    bool isNumber;
+} DataItem;
 
-    int forNextLine;  // Line number of the matching NEXT
-    double forStep;   // Step value of the loop
-    double forEnd;    // End value of the loop
-    int forStartLine; // Line number of the FOR statement
-} Variable;
+// A compiled PRINT USING format (format.c)
+typedef struct UsingFormat UsingFormat;
 
 // Global data structures
-extern Line program[MAX_NUM_LINES];
+extern Line **program; // Growable, sorted by line number
 extern int numLines;
-extern Variable variables[MAX_VARIABLES];
+extern int programCapacity;
+extern unsigned int programGeneration; // Bumped whenever lines are added or removed
+extern double *numValues; // Values of numeric variables, indexed by slot
+extern int64_t *intValues; // Values of integer variables, indexed by slot
+extern String *strValues; // Values of string variables, indexed by slot
+extern VariableInfo *variableInfo; // Names, types and arrays, indexed by slot
 extern int numVariables;
-extern double dataValues[MAX_DATA_VALUES];
-extern int numDataValues;
-extern int dataReadPtr; // Pointer for READ statement
+extern int variablesCapacity;
+extern unsigned int symbolGeneration; // Bumped whenever slots are invalidated
+extern DataItem *dataItems; // Every DATA item of the program, in line order
+extern int numDataItems;
+extern int dataItemsCapacity;
+extern int dataReadPtr; // Next item for READ
 extern int currentLine; // Current line being executed
+extern int currentStatement; // Statement within the current line
 extern int nextLine; // Next line to be executed
+extern int nextStatement; // Statement within the next line (END_OF_LINE skips the rest)
 extern bool running;
 
+// Positions are (line index, statement). Lines typed without a line number
+// run as DIRECT_LINE, so loops and GOSUBs work there too.
+#define DIRECT_LINE -1
+#define END_OF_LINE INT_MAX
+
 // GOSUB stack
 #define MAX_GOSUB_STACK 100
-extern int gosubStack[MAX_GOSUB_STACK];
+typedef struct {
+    int returnLine; // Line index to continue at
+    int returnStatement;
+    int loopDepth; // loopStackPtr at the time of the GOSUB
+} GosubFrame;
+extern GosubFrame gosubStack[MAX_GOSUB_STACK];
 extern int gosubStackPtr;
 
+// FOR loop stack
+#define MAX_LOOP_STACK 100
+#define LOOP_DONE -1
+#define LOOP_MISSING -2
+typedef struct {
+    int slot; // Loop variable
+    double end;
+    double step;
+    int line; // Line index of the FOR statement
+    int statement;
+} LoopFrame;
+extern LoopFrame loopStack[MAX_LOOP_STACK];
+extern int loopStackPtr;
+
 // Environment variables
 extern bool emu_amiga_m68k;
+extern bool useBytecode;
+extern bool lineBufferedOutput;
 
 // --- Function Declarations ---
 void executeLoad(Token *tokens, int numTokens);
 void executeDir();
 void executeLine(Line *line);
+void executeStatement(Token *tokens, int numTokens);
 void executeSet(Token *tokens, int numTokens);
-Token getNextToken(char *line, int *pos);
-void tokenizeLine(char *line, Line *lineStruct);
-Variable *findVariable(const char *name);
+Token getNextToken(const char *line, int *pos);
+Keyword lookupKeyword(const char *text, size_t len);
+void setTokenNumber(Token *token, double number);
+void tokenizeLine(const char *line, Line *lineStruct);
+void freeLine(Line *line);
+const char *internString(const char *text, size_t len);
+void resetStringPool();
+int findVariableSlot(const char *name);
+int getVariableSlot(const char *name);
+int getArraySlot(const char *name);
+Array *dimensionArray(int slot, int numDims, const int *extents);
+bool elementAddress(int slot, Value *subscripts, int count, Target *target);
+void storeValue(Target *target, Value *value);
+int tokenSlot(Token *token);
+int assignableSlot(Token *token);
+void variableTarget(int slot, Target *target);
+void resolveLineSlots(Line *line);
+void resetVariables();
+void prepareProgram();
+void prepareLine(Line *line);
 double getNumericValue(Token *token);
-char *getStringValue(Token *token);
 double evaluateExpression(Token *tokens, int numTokens);
+Expr *compileExpression(Token *tokens, int numTokens, bool reportErrors);
+bool evaluateCompiled(Expr *expr, Value *result);
+bool evaluatePrefix(Token *tokens, int numTokens, Value *result, int *consumed);
+bool evaluateValue(Token *tokens, int numTokens, Value *result);
+void releaseValue(Value *value);
+Expr *compileTarget(Token *tokens, int numTokens, bool reportErrors);
+bool evaluateTarget(Expr *expr, Target *target);
+bool resolveTarget(Token *tokens, int numTokens, Target *target, int *consumed);
 bool variableExists(const char *name);
 void addOrUpdateVariable(const char *name, VarType type, double numValue, const char *strValue);
 void executeList(int startLine, int endLine);
 void executeNew();
+void executeRun(Token *tokens, int numTokens);
 void executePrint(Token *tokens, int numTokens);
 void executeInput(Token *tokens, int numTokens);
 void executeLet(Token *tokens, int numTokens);
+void executeDim(Token *tokens, int numTokens);
 void executeIf(Token *tokens, int numTokens);
 void executeFor(Token *tokens, int numTokens);
 void executeNext(Token *tokens, int numTokens);
+bool splitForStatement(Token *tokens, int numTokens, int *toIndex, int *stepIndex);
+bool pushLoop(int slot, double end, double step, int line, int statement);
+int stepLoop(int slot);
+void pairLoops(Line **lines, int count);
 void executeData(Token *tokens, int numTokens);
 void executeRead(Token *tokens, int numTokens);
-void executeRestore();
+void executeRestore(Token *tokens, int numTokens);
+void prepareData();
+DataItem *nextDataItem();
+void restoreData(int lineIndex);
 void executeGoto(Token *tokens, int numTokens);
 void executeGosub(Token *tokens, int numTokens);
+void executeOn(Token *tokens, int numTokens);
 void executeReturn();
 void executeEnd();
 void runProgram(int startLine);
+void runBytecode(int line, int statement);
 void addLine(Line *newLine);
+void appendLine(Line *newLine);
+void finishAppend();
+bool loadScript(const char *path);
+void executeSave(Token *tokens, int numTokens);
+
+// Binary program images (image.c)
+uint64_t hashSource(const char *text, size_t len);
+bool isImage(const char *data, size_t size);
+bool saveImage(const char *path, uint64_t sourceHash, bool report);
+bool loadImage(const char *data, size_t size, bool checkHash, uint64_t sourceHash);
+void deleteLine(int index);
+int findLinePosition(int lineNumber, bool *found);
+int findLineIndex(int lineNumber);
+int resolveJumpTarget(Token *token);
+
+// Buffered output (output.c)
+void initOutput();
+void outFlush();
+void outWrite(const char *data, size_t len);
+void outPutc(char c);
+void outPrintf(const char *format, ...);
+void outNumber(double value);
+
+// String heap (stringheap.c)
+String stringLiteral(const char *text, int length);
+String stringCopy(const char *text, int length);
+void stringRetain(String *s);
+void stringRelease(String *s);
+void stringAssign(String *dest, String *value, bool owned);
+String stringSlice(const String *s, int start, int length);
+bool stringConcat(String *result, String *a, bool ownsA, const String *b);
+int stringCompare(const String *a, const String *b);
+int stringFind(const String *s, const String *pattern, int start);
+
+// Statement profiler (profile.c)
+extern bool profiling; // Set while a run is being profiled
+extern bool profileRuns; // --profile: profile every RUN
+extern const char *profileStacksPath; // --profile=FILE: collapsed stacks go here
+void startProfile(const char *collapsedPath);
+void profileStatement(int line, int statement);
+void finishProfile();
+void runProfiled(int startLine, const char *collapsedPath);
+
+// Runtime counters (stats.c)
+typedef struct {
+    uint64_t statements; // Only counted while SET STATS = TRUE or profiling
+    uint64_t variableLookups; // Searches of the symbol table by name
+    uint64_t variableProbes; // Hash table positions those searches looked at
+    uint64_t longestProbe;
+    uint64_t linesLexed;
+    uint64_t tokensLexed;
+    uint64_t linesInserted;
+    uint64_t gosubHighWater; // Deepest the GOSUB stack has been
+    uint64_t dataReads;
+    uint64_t bytesPrinted;
+    uint64_t allocations; // Lines, token arrays, compiled expressions, string buffers and arrays
+} Stats;
+extern Stats stats;
+extern bool statsEnabled;
+void countStatement(int line, int statement);
+void executeStats();
+void initStats();
+
+// Commands started by LOAD, and background jobs (jobs.c)
+void runCommand(char *const argv[], bool background);
+void reapJobs();
+void executeJobs();
+void executeWait(Token *tokens, int numTokens);
+
+// RND (random.c)
+double randomNumber(double x);
+
+// Vector kernels (vector.c), chosen for the CPU by initVectorKernels()
+typedef struct {
+    const char *name; // Instruction set
+    void (*add)(double *out, const double *a, const double *b, int n);
+    void (*subtract)(double *out, const double *a, const double *b, int n);
+    void (*scale)(double *out, const double *a, double k, int n);
+    void (*axpy)(double *out, const double *a, double k, int n); // out += a * k
+    double (*sum)(const double *a, int n);
+    double (*dot)(const double *a, const double *b, int n);
+} VectorKernels;
+extern VectorKernels vectorKernels;
+void initVectorKernels();
+
+// MAT statements and array reductions (mat.c)
+void executeMat(Token *tokens, int numTokens);
+bool arraySum(int slot, double *result);
+bool arrayDot(int slotA, int slotB, double *result);
+
+// Number formatting and PRINT USING (format.c)
+int formatNumber(double value, char *buffer);
+UsingFormat *usingFormat(Token *usingToken, const char *source, int length);
+int usingFieldCount(UsingFormat *format);
+int printUsingValue(UsingFormat *format, int fieldIndex, Value *value);
+void printUsingEnd(UsingFormat *format, int fieldIndex);
+void freeUsingFormat(UsingFormat *format);
 
 // Math operations
-void executeAdd(char *arg1, char *arg2);
-void executeSub(char *arg1, char *arg2);
-void executeDiv(char *arg1, char *arg2);
-void executeFloor(char *arg);
+void executeAdd(Token *arg1, Token *arg2);
+void executeSub(Token *arg1, Token *arg2);
+void executeDiv(Token *arg1, Token *arg2);
+void executeFloor(Token *arg);
 
 #endif // CBSH_H
@@ -1,239 +1,313 @@
 #include "cbsh.h"
 
-// --- Helper Functions ---
-
-// Find the line number of the target
-int findLineIndex(int lineNumber) {
-    for (int i = 0; i < numLines; i++) {
-        if (program[i].lineNumber == lineNumber) {
-            return i;
-        }
-    }
-    return -1;  // Not found
-}
-
 // --- Command Execution Functions ---
 
 // Execute LIST command
 void executeList(int startLine, int endLine) {
-    for (int i = 0; i < numLines; i++) {
-        if (program[i].lineNumber >= startLine && (endLine == -1 || program[i].lineNumber <= endLine)) {
-            printf("%d ", program[i].lineNumber);
-            for (int j = 0; j < program[i].numTokens; j++) {
-                printf("%s ", program[i].tokens[j].value);
-            }
-            printf("\n");
+    bool found;
+    for (int i = findLinePosition(startLine, &found); i < numLines; i++) {
+        if (endLine != -1 && program[i]->lineNumber > endLine) {
+            break;
+        }
+        outPrintf("%d ", program[i]->lineNumber);
+        for (int j = 0; j < program[i]->numTokens; j++) {
+            outPrintf("%s ", program[i]->tokens[j].value);
         }
+        outPrintf("\n");
     }
 }
 
 // ADD command: Adds two numbers
-void executeAdd(char *arg1, char *arg2) {
-    double a = atof(arg1);
-    double b = atof(arg2);
-    printf("Result: %.2f\n", a + b);
+void executeAdd(Token *arg1, Token *arg2) {
+    double a = getNumericValue(arg1);
+    double b = getNumericValue(arg2);
+    outPrintf("Result: %.2f\n", a + b);
 }
 
 // SUB command: Subtracts second number from first
-void executeSub(char *arg1, char *arg2) {
-    double a = atof(arg1);
-    double b = atof(arg2);
-    printf("Result: %.2f\n", a - b);
+void executeSub(Token *arg1, Token *arg2) {
+    double a = getNumericValue(arg1);
+    double b = getNumericValue(arg2);
+    outPrintf("Result: %.2f\n", a - b);
 }
 
 // DIV command: Divides first number by second
-void executeDiv(char *arg1, char *arg2) {
-    double a = atof(arg1);
-    double b = atof(arg2);
+void executeDiv(Token *arg1, Token *arg2) {
+    double a = getNumericValue(arg1);
+    double b = getNumericValue(arg2);
     if (b == 0) {
-        printf("Error: Division by zero\n");
+        outPrintf("Error: Division by zero\n");
         return;
     }
-    printf("Result: %.2f\n", a / b);
+    outPrintf("Result: %.2f\n", a / b);
 }
 
 // FLOOR command: Floors a number
-void executeFloor(char *arg) {
-    double a = atof(arg);
-    printf("Result: %.0f\n", floor(a));
+void executeFloor(Token *arg) {
+    double a = getNumericValue(arg);
+    outPrintf("Result: %.0f\n", floor(a));
 }
 
 // Execute NEW command
 void executeNew() {
-    numLines = 0;
-    numVariables = 0;
-    numDataValues = 0;
+    while (numLines > 0) {
+        deleteLine(numLines - 1);
+    }
+    numDataItems = 0;
     dataReadPtr = 0;
     currentLine = 0;
     running = false;
     gosubStackPtr = 0; // Reset GOSUB stack
-    for (int i = 0; i < MAX_VARIABLES; i++) {
-        variables[i].name[0] = '\0'; // Invalidate the variable
+    loopStackPtr = 0; // Reset FOR loop stack
+    resetVariables();
+    resetStringPool(); // No tokens refer to pooled strings any more
+}
+
+// Execute RUN [line], or RUN PROFILE ["file"] to profile the run (and write its
+// collapsed call stacks to the file)
+void executeRun(Token *tokens, int numTokens) {
+    bool profile = profileRuns;
+    const char *collapsedPath = profileStacksPath;
+    int startLine = 0;
+    if (numTokens >= 2 && tokens[1].type == TOKEN_IDENTIFIER && strcasecmp(tokens[1].value, "PROFILE") == 0) {
+        profile = true;
+        if (numTokens == 3 && tokens[2].type == TOKEN_STRING) {
+            collapsedPath = tokens[2].value;
+        } else if (numTokens != 2) {
+            outPrintf("Invalid RUN statement\n");
+            return;
+        }
+    } else if (numTokens == 2 && tokens[1].type == TOKEN_NUMBER) {
+        startLine = (int)tokens[1].number; // RUN <line>
+    } else if (numTokens != 1) {
+        outPrintf("Invalid RUN statement\n");
+        return;
+    }
+    if (profile) {
+        runProfiled(startLine, collapsedPath);
+    } else {
+        runProgram(startLine);
+    }
+}
+
+// Print a string, interpreting backslash escapes when requested (PRINT -e)
+static void printString(const String *s, bool escapes) {
+    const char *str = stringChars(s);
+    if (!escapes) {
+        outWrite(str, s->length);
+        return;
+    }
+    // Use echo -e-like behavior for escape sequences
+    for (int j = 0; j < s->length; j++) {
+        if (str[j] == '\\' && j + 1 < s->length) {
+            j++; // Skip the backslash
+            switch (str[j]) {
+                case 'n': outPutc('\n'); break;
+                case 't': outPutc('\t'); break;
+                case '\\': outPutc('\\'); break;
+                case 'r': outPutc('\r'); break;
+                case 'b': outPutc('\b'); break;
+                case 'f': outPutc('\f'); break;
+                case 'v': outPutc('\v'); break;
+                default: outPutc('\\'); outPutc(str[j]); break;
+            }
+        } else {
+            outPutc(str[j]);
+        }
+    }
+}
+
+// PRINT USING format; value, value ... (tokens start at USING). The format
+// is compiled once and kept on the USING token.
+static void printUsing(Token *tokens, int numTokens) {
+    Value value;
+    int consumed;
+    if (!evaluatePrefix(tokens + 1, numTokens - 1, &value, &consumed)) {
+        return;
+    }
+    if (value.type != VAR_TYPE_STRING) {
+        outPrintf("Type mismatch: USING needs a format string\n");
+        return;
+    }
+    UsingFormat *format = usingFormat(&tokens[0], stringChars(&value.str), value.str.length);
+    releaseValue(&value);
+    int i = 1 + consumed;
+    if (i >= numTokens || strcmp(tokens[i].value, ";") != 0) {
+        outPrintf("Syntax error: missing ; after USING format\n");
+        return;
+    }
+    i++;
+
+    if (!format) {
+        return;
+    }
+    if (usingFieldCount(format) == 0) {
+        outPrintf("No field in USING format\n");
+        return;
+    }
+
+    int field = 0;
+    bool newline = true;
+    while (i < numTokens) {
+        if (tokens[i].type == TOKEN_OPERATOR && (strcmp(tokens[i].value, ",") == 0 || strcmp(tokens[i].value, ";") == 0)) {
+            newline = false; // A separator at the end leaves the line open
+            i++;
+            continue;
+        }
+        if (!evaluatePrefix(&tokens[i], numTokens - i, &value, &consumed)) {
+            return;
+        }
+        i += consumed;
+        field = printUsingValue(format, field, &value);
+        releaseValue(&value);
+        newline = true;
+    }
+    printUsingEnd(format, field);
+    if (newline) {
+        outPutc('\n');
     }
 }
 
 // Execute PRINT command
 void executePrint(Token *tokens, int numTokens) {
-    int enableEscapeSequences = 0;  // Flag for the -e option
-
-    // Check if -e is the first token
-    if (numTokens > 1 && strcmp(tokens[1].value, "-e") == 0) {
-        enableEscapeSequences = 1;
-        // Skip the -e token in the print processing
-        tokens++;
-        numTokens--;
+    if (numTokens > 1 && tokens[1].keyword == KW_USING) {
+        printUsing(tokens + 1, numTokens - 1);
+        return;
     }
 
-    for (int i = 1; i < numTokens; i++) {
-        switch (tokens[i].type) {
-            case TOKEN_STRING:
-                if (enableEscapeSequences) {
-                    // Use echo -e-like behavior for escape sequences
-                    char *str = tokens[i].value;
-                    for (int j = 0; str[j] != '\0'; j++) {
-                        if (str[j] == '\\' && str[j+1] != '\0') {
-                            j++; // Skip the backslash
-                            switch (str[j]) {
-                                case 'n': printf("\n"); break;
-                                case 't': printf("\t"); break;
-                                case '\\': printf("\\"); break;
-                                case 'r': printf("\r"); break;
-                                case 'b': printf("\b"); break;
-                                case 'f': printf("\f"); break;
-                                case 'v': printf("\v"); break;
-                                default: printf("\\%c", str[j]); break;
-                            }
-                        } else {
-                            putchar(str[j]);
-                        }
+    bool enableEscapeSequences = false;  // Flag for the -e option
+    int i = 1;
+
+    // Check if -e is the first argument (lexed as "-" followed by "e")
+    if (numTokens > 2 && strcmp(tokens[1].value, "-") == 0 && strcasecmp(tokens[2].value, "e") == 0) {
+        enableEscapeSequences = true;
+        i = 3;
+    }
+
+    bool newline = true;
+    while (i < numTokens) {
+        Token *token = &tokens[i];
+        newline = true;
+        if (token->type == TOKEN_OPERATOR && strcmp(token->value, ";") == 0) {
+            // No separator, and no newline if it ends the statement
+            newline = false;
+            i++;
+        } else if (token->type == TOKEN_OPERATOR && strcmp(token->value, ",") == 0) {
+            outPutc('\t');
+            newline = false;
+            i++;
+        } else if (token->keyword == KW_TAB) {
+            // TAB(n) or TAB n: print n spaces
+            int consumed;
+            Value value;
+            i++;
+            if (i < numTokens && evaluatePrefix(&tokens[i], numTokens - i, &value, &consumed)) {
+                i += consumed;
+                if (value.type == VAR_TYPE_NUMERIC) {
+                    for (int j = 0; j < (int)value.num; j++) {
+                        outPutc(' ');
                     }
-                } else {
-                    // No escape sequences, just print the string as-is
-                    printf("%s", tokens[i].value);
                 }
-                break;
-            case TOKEN_IDENTIFIER: {
-                Variable *var = findVariable(tokens[i].value);
-                if (var) {
-                    if (var->type == VAR_TYPE_NUMERIC) {
-                        printf("%g", var->numValue);
-                    } else {
-                        printf("%s", var->strValue);
-                    }
-                } else {
-                    printf("0"); // Default value for undefined numeric variables
-                }
-                break;
+                releaseValue(&value);
+            } else {
+                return;
+            }
+        } else {
+            // An expression item; items may also follow each other directly
+            int consumed;
+            Value value;
+            if (!evaluatePrefix(&tokens[i], numTokens - i, &value, &consumed)) {
+                return;
+            }
+            i += consumed;
+            if (value.type == VAR_TYPE_NUMERIC) {
+                outNumber(value.num);
+            } else {
+                printString(&value.str, enableEscapeSequences);
+                releaseValue(&value);
             }
-            case TOKEN_NUMBER:
-                printf("%g", atof(tokens[i].value));
-                break;
-            case TOKEN_OPERATOR:
-                if (strcmp(tokens[i].value, ",") == 0) {
-                    printf("\t");
-                } else if (strcmp(tokens[i].value, ";") == 0) {
-                    // No newline, just continue printing
-                } else {
-                    printf(" ");
-                }
-                break;
-            case TOKEN_KEYWORD:
-                if (tokens[i].keyword == KW_TAB) {
-                    if (i + 1 < numTokens && tokens[i + 1].type == TOKEN_NUMBER) {
-                        int spaces = atoi(tokens[i + 1].value);
-                        for (int j = 0; j < spaces; j++) {
-                            printf(" ");
-                        }
-                        i++;
-                    }
-                } else {
-                    printf(" ");
-                }
-                break;
-            default:
-                printf(" ");
-                break;
         }
     }
 
-    if (numTokens > 1 && tokens[numTokens - 1].type == TOKEN_OPERATOR && strcmp(tokens[numTokens - 1].value, ";") == 0) {
-        // No newline
-    } else {
-        printf("\n");
+    if (newline) {
+        outPutc('\n');
     }
 }
-// Execute LOAD command
-void executeLoad(Token *tokens, int numTokens) {
-    if (numTokens < 2 || tokens[1].type != TOKEN_STRING) {
-        printf("Invalid LOAD statement, try with double quotes with the cmdname in double quotes.\n");
-        return;
+// Append a copy of one word to LOAD's growing argument vector, keeping room
+// for the NULL that ends it
+static bool addArgument(char ***argv, int *argc, int *capacity, const char *word) {
+    if (*argc + 2 > *capacity) {
+        int newCapacity = *capacity ? *capacity * 2 : 16;
+        char **newArgv = realloc(*argv, newCapacity * sizeof(char *));
+        if (!newArgv) {
+            perror("realloc");
+            return false;
+        }
+        *argv = newArgv;
+        *capacity = newCapacity;
     }
+    char *copy = strdup(word);
+    if (!copy) {
+        perror("strdup");
+        return false;
+    }
+    (*argv)[(*argc)++] = copy;
+    (*argv)[*argc] = NULL;
+    return true;
+}
 
-    char *filename = tokens[1].value; // Filename (or command) to execute
-
-    // Construct argv array for execvp
-    char *argv[MAX_LINE_LENGTH]; // Adjust size as needed
-    int argc = 0;
-
-    // Tokenize the command name (might have spaces if quoted)
-    char *cmdCopy = strdup(filename);
-    if (!cmdCopy) {
+// Split a string at spaces into LOAD arguments. In arguments after the
+// command, ~ stands for the home directory.
+static bool addArguments(char ***argv, int *argc, int *capacity, const char *text, bool expandHome) {
+    char *copy = strdup(text);
+    if (!copy) {
         perror("strdup");
-        return;
+        return false;
+    }
+    bool ok = true;
+    for (char *word = strtok(copy, " "); word && ok; word = strtok(NULL, " ")) {
+        if (expandHome && strcmp(word, "~") == 0) {
+            char *home = getenv("HOME");
+            if (home) {
+                ok = addArgument(argv, argc, capacity, home);
+            }
+        } else {
+            ok = addArgument(argv, argc, capacity, word);
+        }
     }
+    free(copy);
+    return ok;
+}
 
-    char *cmdToken = strtok(cmdCopy, " ");
-    while (cmdToken != NULL) {
-        argv[argc++] = strdup(cmdToken);  // Store a separate copy
-        cmdToken = strtok(NULL, " ");
+// Execute LOAD command
+void executeLoad(Token *tokens, int numTokens) {
+    if (numTokens < 2 || tokens[1].type != TOKEN_STRING) {
+        outPrintf("Invalid LOAD statement, try with double quotes with the cmdname in double quotes.\n");
+        return;
     }
-    free(cmdCopy); // Now safe to free
 
-    // Add arguments, handling ~, ., .., -, --
-    for (int i = 2; i < numTokens; i++) {
+    // The command string, then every further string, split into words
+    char **argv = NULL;
+    int argc = 0;
+    int capacity = 0;
+    bool ok = addArguments(&argv, &argc, &capacity, tokens[1].value, false);
+    for (int i = 2; i < numTokens && ok; i++) {
         if (tokens[i].type == TOKEN_STRING) {
-            char *argCopy = strdup(tokens[i].value);
-            if (!argCopy) {
-                perror("strdup");
-                return;
-            }
-
-            char *argToken = strtok(argCopy, " ");
-            while (argToken != NULL) {
-                if (strcmp(argToken, "~") == 0) {
-                    char *home = getenv("HOME");
-                    if (home) argv[argc++] = strdup(home);
-                } else if (strcmp(argToken, ".") == 0 || strcmp(argToken, "..") == 0 ||
-                           strcmp(argToken, "-") == 0 || strcmp(argToken, "--") == 0) {
-                    argv[argc++] = strdup(argToken);
-                } else {
-                    argv[argc++] = strdup(argToken);
-                }
-                argToken = strtok(NULL, " ");
-            }
-            free(argCopy);
+            ok = addArguments(&argv, &argc, &capacity, tokens[i].value, true);
         }
     }
-    argv[argc] = NULL;
 
-    // Execute the command
-    pid_t pid = fork();
-    if (pid == 0) {
-        // Child process
-        execvp(argv[0], argv);
-        perror("execvp");
-        exit(1);
-    } else if (pid > 0) {
-        // Parent process
-        wait(NULL);
-    } else {
-        perror("fork");
+    if (ok) {
+        // A trailing & runs the command in the background
+        bool background = tokens[numTokens - 1].type == TOKEN_OPERATOR && strcmp(tokens[numTokens - 1].value, "&") == 0;
+        char *none[] = {NULL};
+        runCommand(argv ? argv : none, background);
     }
 
-    // Free allocated argument copies
     for (int i = 0; i < argc; i++) {
         free(argv[i]);
     }
+    free(argv);
 }
 
 // Execute DIR command
@@ -244,7 +318,7 @@ void executeDir() {
         if (dir) {
             struct dirent *entry;
             while ((entry = readdir(dir)) != NULL) {
-                printf("%s\n", entry->d_name);
+                outPrintf("%s\n", entry->d_name);
             }
             closedir(dir);
         } else {
@@ -258,100 +332,144 @@ void executeDir() {
 // Execute INPUT command
 void executeInput(Token *tokens, int numTokens) {
     if (numTokens < 2) {
-        printf("Invalid INPUT statement\n");
+        outPrintf("Invalid INPUT statement\n");
         return;
     }
 
     int varIndex = 1;
     if (tokens[1].type == TOKEN_STRING) {
-        printf("%s", tokens[1].value);
+        outPrintf("%s", tokens[1].value);
         varIndex = 2;
         if (varIndex >= numTokens || tokens[varIndex].type != TOKEN_IDENTIFIER) {
-            printf("Missing variable in INPUT statement\n");
+            outPrintf("Missing variable in INPUT statement\n");
             return;
         }
     } else if (tokens[1].type == TOKEN_IDENTIFIER) {
-        printf("? ");
+        outPrintf("? ");
     } else {
-        printf("Invalid INPUT statement\n");
+        outPrintf("Invalid INPUT statement\n");
         return;
     }
 
-    Variable *var = findVariable(tokens[varIndex].value);
-    if (!var) {
-        if (strchr(tokens[varIndex].value, '$') != NULL) {
-            addOrUpdateVariable(tokens[varIndex].value, VAR_TYPE_STRING, 0, "");
-            var = findVariable(tokens[varIndex].value);
-        } else {
-            addOrUpdateVariable(tokens[varIndex].value, VAR_TYPE_NUMERIC, 0, "");
-            var = findVariable(tokens[varIndex].value);
-        }
+    Target target;
+    int consumed;
+    if (!resolveTarget(&tokens[varIndex], numTokens - varIndex, &target, &consumed)) {
+        return;
     }
 
-    char inputBuffer[MAX_LINE_LENGTH];
-    if (fgets(inputBuffer, sizeof(inputBuffer), stdin) == NULL) {
-        printf("Error reading input\n");
+    // Lines of any length
+    static char *inputBuffer = NULL;
+    static size_t inputBufferSize = 0;
+    outFlush(); // Show the prompt before waiting
+    ssize_t length = getline(&inputBuffer, &inputBufferSize, stdin);
+    if (length < 0) {
+        outPrintf("Error reading input\n");
         return;
     }
+    length = strcspn(inputBuffer, "\n");
+    inputBuffer[length] = 0;
 
-    inputBuffer[strcspn(inputBuffer, "\n")] = 0;
-
-    if (var->type == VAR_TYPE_NUMERIC) {
+    if (target.type != VAR_TYPE_STRING) {
         char *endptr;
-        double numValue = strtod(inputBuffer, &endptr);
+        Value value = {.type = VAR_TYPE_NUMERIC, .num = strtod(inputBuffer, &endptr)};
         if (*endptr != '\0') {
-            printf("Invalid number input\n");
-            var->numValue = 0;
-        } else {
-            var->numValue = numValue;
+            outPrintf("Invalid number input\n");
+            value.num = 0;
         }
+        storeValue(&target, &value);
     } else {
-        strcpy(var->strValue, inputBuffer);
+        String text = stringCopy(inputBuffer, length);
+        stringAssign(target.str, &text, true);
     }
 }
 
 // Execute LET command (and implicit assignment)
 void executeLet(Token *tokens, int numTokens) {
     if (numTokens < 3) {
-        printf("Invalid LET statement\n");
+        outPrintf("Invalid LET statement\n");
         return;
     }
 
-    int assignmentOpIndex = -1;
-    for (int i = 0; i < numTokens; i++) {
-        if (tokens[i].type == TOKEN_OPERATOR && strcmp(tokens[i].value, "=") == 0) {
-            assignmentOpIndex = i;
-            break;
-        }
+    // The target follows LET when it is written out
+    int targetIndex = tokens[0].keyword == KW_LET ? 1 : 0;
+    if (tokens[targetIndex].type != TOKEN_IDENTIFIER) {
+        outPrintf("Invalid LET statement\n");
+        return;
     }
 
-    if (assignmentOpIndex == -1) {
-        printf("Missing '=' in LET statement\n");
+    Target target;
+    int consumed;
+    if (!resolveTarget(&tokens[targetIndex], numTokens - targetIndex, &target, &consumed)) {
+        return;
+    }
+    int assignmentOpIndex = targetIndex + consumed;
+    if (assignmentOpIndex >= numTokens || tokens[assignmentOpIndex].type != TOKEN_OPERATOR ||
+        strcmp(tokens[assignmentOpIndex].value, "=") != 0) {
+        outPrintf("Missing '=' in LET statement\n");
         return;
     }
 
-    char varName[MAX_LINE_LENGTH];
-    strncpy(varName, tokens[0].value, sizeof(varName) - 1);
-    varName[sizeof(varName) - 1] = '\0';
-
-    VarType varType;
-    if (strchr(varName, '$') != NULL) {
-        varType = VAR_TYPE_STRING;
-    } else {
-        varType = VAR_TYPE_NUMERIC;
+    Value value;
+    if (!evaluateValue(&tokens[assignmentOpIndex + 1], numTokens - assignmentOpIndex - 1, &value)) {
+        return;
     }
+    storeValue(&target, &value);
+}
 
-    if (varType == VAR_TYPE_NUMERIC) {
-        double value = evaluateExpression(&tokens[assignmentOpIndex + 1], numTokens - assignmentOpIndex - 1);
-        addOrUpdateVariable(varName, varType, value, "");
-    } else {
-        if (tokens[assignmentOpIndex + 1].type == TOKEN_STRING) {
-            addOrUpdateVariable(varName, varType, 0, tokens[assignmentOpIndex + 1].value);
-        } else if (tokens[assignmentOpIndex + 1].type == TOKEN_IDENTIFIER) {
-            char *strValue = getStringValue(&tokens[assignmentOpIndex + 1]);
-            addOrUpdateVariable(varName, varType, 0, strValue);
-        } else {
-            printf("Invalid string expression in LET\n");
+// True if a token is the given operator or punctuation
+static bool isOperatorToken(Token *token, const char *op) {
+    return token->type == TOKEN_OPERATOR && strcmp(token->value, op) == 0;
+}
+
+// Execute DIM command: DIM A(n[, m...])[, B$(k)...]. Subscripts run from 0
+// to the bound given. Dimensioning an array again replaces its elements.
+void executeDim(Token *tokens, int numTokens) {
+    int i = 1;
+    while (i < numTokens) {
+        Token *name = &tokens[i];
+        if (name->type != TOKEN_IDENTIFIER || i + 1 >= numTokens || !isOperatorToken(&tokens[i + 1], "(")) {
+            outPrintf("Invalid DIM statement\n");
+            return;
+        }
+        i += 2;
+
+        int extents[MAX_DIMENSIONS];
+        int numDims = 0;
+        do {
+            if (numDims > 0) {
+                i++; // The comma
+            }
+            Value bound;
+            int consumed;
+            if (i >= numTokens || !evaluatePrefix(&tokens[i], numTokens - i, &bound, &consumed)) {
+                outPrintf("Invalid DIM statement\n");
+                return;
+            }
+            if (bound.type != VAR_TYPE_NUMERIC) {
+                outPrintf("Type mismatch\n");
+                releaseValue(&bound);
+                return;
+            }
+            if (numDims == MAX_DIMENSIONS || !(bound.num >= 0 && bound.num < INT_MAX)) {
+                outPrintf("Bad subscript in DIM %s\n", name->value);
+                return;
+            }
+            extents[numDims++] = (int)bound.num + 1;
+            i += consumed;
+        } while (i < numTokens && isOperatorToken(&tokens[i], ","));
+        if (i >= numTokens || !isOperatorToken(&tokens[i], ")")) {
+            outPrintf("Invalid DIM statement\n");
+            return;
+        }
+        i++;
+
+        int slot = name->slot >= 0 ? name->slot : getArraySlot(name->value);
+        if (!dimensionArray(slot, numDims, extents)) {
+            return;
+        }
+        if (i < numTokens && !isOperatorToken(&tokens[i++], ",")) {
+            outPrintf("Invalid DIM statement\n");
+            return;
         }
     }
 }
@@ -367,363 +485,483 @@ void executeIf(Token *tokens, int numTokens) {
     }
 
     if (thenIndex == -1) {
-        printf("Invalid IF statement: THEN not found\n");
+        outPrintf("Invalid IF statement: THEN not found\n");
         return;
     }
 
     double conditionResult = evaluateExpression(tokens + 1, thenIndex - 1);
 
-    if (conditionResult != 0) {
-        Line thenStatement;
-        thenStatement.lineNumber = 0;
-        thenStatement.numTokens = 0;
-        for (int i = thenIndex + 1; i < numTokens; i++) {
-            thenStatement.tokens[thenStatement.numTokens++] = tokens[i];
-        }
-        executeLine(&thenStatement);
+    if (conditionResult == 0) {
+        nextStatement = END_OF_LINE; // A false IF skips the rest of the line
+    } else if (numTokens - thenIndex == 2 && tokens[thenIndex + 1].type == TOKEN_NUMBER) {
+        // IF ... THEN <line> is IF ... THEN GOTO <line>
+        executeGoto(tokens + thenIndex, 2);
+    } else {
+        // Run the tail of the statement in place; no tokens are copied
+        executeStatement(tokens + thenIndex + 1, numTokens - thenIndex - 1);
     }
 }
 
-// execute for
-void executeFor(Token *tokens, int numTokens) {
-    if (numTokens < 7 || tokens[2].type != TOKEN_OPERATOR || strcmp(tokens[2].value, "=") != 0 || tokens[4].keyword != KW_TO) {
-        printf("Invalid FOR statement\n");
-        return;
+// Find TO and the optional STEP in "FOR var = start TO end [STEP step]".
+// stepIndex is numTokens when there is no STEP.
+bool splitForStatement(Token *tokens, int numTokens, int *toIndex, int *stepIndex) {
+    *toIndex = -1;
+    *stepIndex = numTokens;
+    for (int i = 3; i < numTokens; i++) {
+        if (tokens[i].keyword == KW_TO && *toIndex == -1) {
+            *toIndex = i;
+        } else if (tokens[i].keyword == KW_STEP && *toIndex != -1) {
+            *stepIndex = i;
+            break;
+        }
     }
+    return numTokens >= 6 && tokens[1].type == TOKEN_IDENTIFIER && tokens[2].type == TOKEN_OPERATOR &&
+           strcmp(tokens[2].value, "=") == 0 && *toIndex != -1 && *stepIndex != numTokens - 1;
+}
 
-    char *varName = tokens[1].value;
-    double startValue = evaluateExpression(&tokens[3], 1);
-    double endValue = evaluateExpression(&tokens[5], 1);
-    double stepValue = 1;  // Default step
-
-    int stepIndex = 6;
-    if (stepIndex < numTokens && tokens[stepIndex].keyword == KW_STEP) {
-        if (stepIndex + 1 < numTokens) {
-            stepValue = evaluateExpression(&tokens[stepIndex + 1], 1);
-        } else {
-            printf("Missing value after STEP\n");
-            return;
+// Open a loop frame for the FOR statement at a position. Running the same FOR
+// again (e.g. after leaving its loop with GOTO) drops its old frame and any
+// frames above it, so the stack cannot grow without bound.
+bool pushLoop(int slot, double end, double step, int line, int statement) {
+    for (int i = loopStackPtr - 1; i >= 0; i--) {
+        if (loopStack[i].line == line && loopStack[i].statement == statement && loopStack[i].slot == slot) {
+            loopStackPtr = i;
+            break;
         }
     }
+    if (loopStackPtr >= MAX_LOOP_STACK) {
+        outPrintf("Too many nested FOR loops\n");
+        return false;
+    }
+    LoopFrame *frame = &loopStack[loopStackPtr++];
+    frame->slot = slot;
+    frame->end = end;
+    frame->step = step;
+    frame->line = line;
+    frame->statement = statement;
+    return true;
+}
 
-    // Ensure variable exists
-    Variable *loopVar = findVariable(varName);
-    if (!loopVar) {
-        addOrUpdateVariable(varName, VAR_TYPE_NUMERIC, startValue, "");
-        loopVar = findVariable(varName);
-    } else {
-        loopVar->numValue = startValue;
-    }
-
-    loopVar->forStep = stepValue;
-    loopVar->forEnd = endValue;
-    loopVar->forStartLine = currentLine;
-
-    // Find matching NEXT statement
-    int nextLineIndex = -1;
-    int nestedForCount = 1; // Track nested loops
-
-    for (int i = currentLine + 1; i < numLines; i++) {
-        if (program[i].numTokens > 0) {
-            if (program[i].tokens[0].keyword == KW_FOR) {
-                nestedForCount++; // Nested FOR detected
-            } else if (program[i].tokens[0].keyword == KW_NEXT) {
-                if (program[i].numTokens > 1 && program[i].tokens[1].type == TOKEN_IDENTIFIER) {
-                    if (strcmp(program[i].tokens[1].value, varName) == 0) {
-                        nestedForCount--; // Matching NEXT for this FOR
-                        if (nestedForCount == 0) {
-                            nextLineIndex = i;
-                            break;
-                        }
-                    }
-                } else {
-                    nestedForCount--; // Handle NEXT without a variable
-                    if (nestedForCount == 0) {
-                        nextLineIndex = i;
-                        break;
-                    }
-                }
-            }
+// Step the loop of a NEXT; slot -1 means the innermost loop. Returns the
+// stack index of the loop when it goes round again (its body starts at the
+// statement after its FOR), LOOP_DONE when the loop has finished, or
+// LOOP_MISSING (after reporting it) when there is no such loop.
+int stepLoop(int slot) {
+    int i = loopStackPtr - 1;
+    if (slot >= 0) {
+        while (i >= 0 && loopStack[i].slot != slot) {
+            i--;
         }
     }
-
-    if (nextLineIndex == -1) {
-        printf("FOR without matching NEXT\n");
-        return;
+    if (i < 0) {
+        outPrintf("NEXT without FOR\n");
+        return LOOP_MISSING;
     }
 
-    loopVar->forNextLine = nextLineIndex;
-    nextLine = currentLine + 1;
+    LoopFrame *frame = &loopStack[i];
+    double *value = &numValues[frame->slot];
+    *value += frame->step;
+    if ((frame->step > 0 && *value > frame->end) || (frame->step < 0 && *value < frame->end)) {
+        loopStackPtr = i; // Finished: drop it and any loops left open inside it
+        return LOOP_DONE;
+    }
+    loopStackPtr = i + 1;
+    return i;
 }
 
-// Execute NEXT command
-void executeNext(Token *tokens, int numTokens) {
-    char *varName = NULL;
-    if (numTokens > 1 && tokens[1].type == TOKEN_IDENTIFIER) {
-        varName = tokens[1].value;
+// execute for
+void executeFor(Token *tokens, int numTokens) {
+    int toIndex, stepIndex;
+    if (!splitForStatement(tokens, numTokens, &toIndex, &stepIndex)) {
+        outPrintf("Invalid FOR statement\n");
+        return;
+    }
+    if (tokens[0].target == -1) {
+        outPrintf("FOR without matching NEXT\n");
+        return;
     }
 
-    int forLineIndex = -1;
-    Variable *loopVar = NULL;
-    if (varName) {
-        loopVar = findVariable(varName);
-        if (loopVar) {
-            forLineIndex = loopVar->forStartLine;
-        }
-    } else {
-        for (int i = currentLine - 1; i >= 0; i--) {
-            if (program[i].numTokens > 0 && program[i].tokens[0].keyword == KW_FOR) {
-                loopVar = findVariable(program[i].tokens[1].value);
-                if (loopVar) {
-                    forLineIndex = i;
-                    break;
-                }
-            }
-        }
+    double startValue = evaluateExpression(&tokens[3], toIndex - 3);
+    double endValue = evaluateExpression(&tokens[toIndex + 1], stepIndex - toIndex - 1);
+    double stepValue = 1;  // Default step
+    if (stepIndex < numTokens) {
+        stepValue = evaluateExpression(&tokens[stepIndex + 1], numTokens - stepIndex - 1);
     }
 
-    if (forLineIndex == -1 || !loopVar) {
-        printf("NEXT without FOR\n");
+    // Ensure variable exists
+    int slot = assignableSlot(&tokens[1]);
+    if (variableInfo[slot].type != VAR_TYPE_NUMERIC) {
+        outPrintf("Type mismatch: FOR needs a numeric variable: %s\n", tokens[1].value);
         return;
     }
+    numValues[slot] = startValue;
 
-    loopVar->numValue += loopVar->forStep;
+    // The body always runs once; NEXT decides whether to go round again
+    pushLoop(slot, endValue, stepValue, currentLine, currentStatement);
+}
 
-    if ((loopVar->forStep > 0 && loopVar->numValue > loopVar->forEnd) ||
-        (loopVar->forStep < 0 && loopVar->numValue < loopVar->forEnd)) {
-        nextLine = currentLine + 1;
-    } else {
-        nextLine = loopVar->forStartLine + 1;
-    }
+// Continue at the body of the loop in a stack frame
+static void repeatLoop(int frame) {
+    nextLine = loopStack[frame].line;
+    nextStatement = loopStack[frame].statement + 1;
 }
 
-// Execute DATA command
-void executeData(Token *tokens, int numTokens) {
+// Execute NEXT command: NEXT, NEXT var or NEXT var1, var2, ...
+void executeNext(Token *tokens, int numTokens) {
+    if (numTokens < 2) {
+        int frame = stepLoop(-1);
+        if (frame >= 0) {
+            repeatLoop(frame);
+        }
+        return;
+    }
+
     for (int i = 1; i < numTokens; i++) {
-        if (tokens[i].type == TOKEN_NUMBER) {
-            if (numDataValues < MAX_DATA_VALUES) {
-                dataValues[numDataValues++] = atof(tokens[i].value);
-            } else {
-                printf("Too many DATA values\n");
-                return;
+        if (tokens[i].type == TOKEN_OPERATOR && strcmp(tokens[i].value, ",") == 0) {
+            continue;
+        }
+        if (tokens[i].type != TOKEN_IDENTIFIER) {
+            outPrintf("Invalid NEXT statement\n");
+            return;
+        }
+        int slot = tokens[i].slot >= 0 ? tokens[i].slot : getVariableSlot(tokens[i].value);
+        int frame = stepLoop(slot);
+        if (frame != LOOP_DONE) {
+            if (frame >= 0) {
+                repeatLoop(frame);
             }
-        } else if (tokens[i].type == TOKEN_STRING) {
-            printf("String DATA not yet implemented\n");
             return;
         }
     }
 }
 
-// Execute READ command
+// Execute DATA command: nothing to do, the items are collected before the
+// program runs (see prepareData)
+void executeData(Token *tokens, int numTokens) {
+    (void)tokens;
+    (void)numTokens;
+}
+
+// Execute READ command: READ var1, var2, ...
 void executeRead(Token *tokens, int numTokens) {
     if (numTokens < 2) {
-        printf("Invalid READ statement\n");
+        outPrintf("Invalid READ statement\n");
         return;
     }
 
-    for (int i = 1; i < numTokens; i++) {
-        if (tokens[i].type == TOKEN_IDENTIFIER) {
-            Variable *var = findVariable(tokens[i].value);
-            if (!var) {
-                addOrUpdateVariable(tokens[i].value, VAR_TYPE_NUMERIC, 0, "");
-                var = findVariable(tokens[i].value);
-            }
-
-            if (dataReadPtr < numDataValues) {
-                var->numValue = dataValues[dataReadPtr++];
-            } else {
-                printf("Out of DATA\n");
-                return;
-            }
+    int i = 1;
+    while (i < numTokens) {
+        if (tokens[i].type != TOKEN_IDENTIFIER) {
+            outPrintf("Invalid READ statement\n");
+            return;
+        }
+        Target target;
+        int consumed;
+        if (!resolveTarget(&tokens[i], numTokens - i, &target, &consumed)) {
+            return;
+        }
+        DataItem *item = nextDataItem();
+        if (!item) {
+            outPrintf("Out of DATA\n");
+            return;
+        }
+        if (target.type == VAR_TYPE_STRING) {
+            String text = stringLiteral(item->text, item->length); // DATA text lives until NEW
+            stringAssign(target.str, &text, false);
+        } else if (item->isNumber) {
+            Value value = {.type = VAR_TYPE_NUMERIC, .num = item->number};
+            storeValue(&target, &value);
+        } else {
+            outPrintf("Type mismatch: DATA item %s is not a number\n", item->text);
+            return;
+        }
+        i += consumed;
+        if (i < numTokens && !isOperatorToken(&tokens[i++], ",")) {
+            outPrintf("Invalid READ statement\n");
+            return;
         }
     }
 }
 
-// Execute RESTORE command
-void executeRestore() {
-    dataReadPtr = 0;
+// Execute RESTORE command: RESTORE, or RESTORE <line> to READ from that line on
+void executeRestore(Token *tokens, int numTokens) {
+    if (numTokens < 2) {
+        dataReadPtr = 0;
+        return;
+    }
+    int index = tokens[1].type == TOKEN_NUMBER ? resolveJumpTarget(&tokens[1]) : -1;
+    if (index == -1) {
+        outPrintf("Undefined line %s\n", tokens[1].value);
+        return;
+    }
+    restoreData(index);
 }
 
 // Execute GOTO command
 void executeGoto(Token *tokens, int numTokens) {
     if (numTokens < 2 || tokens[1].type != TOKEN_NUMBER) {
-        printf("Invalid GOTO statement\n");
+        outPrintf("Invalid GOTO statement\n");
         return;
     }
 
-    int targetLine = atoi(tokens[1].value);
-    int targetIndex = findLineIndex(targetLine);
+    int targetIndex = resolveJumpTarget(&tokens[1]);
     if (targetIndex != -1) {
         nextLine = targetIndex;
+        nextStatement = 0;
     } else {
-        printf("Undefined line %d\n", targetLine);
+        outPrintf("Undefined line %s\n", tokens[1].value);
     }
 }
 
 // Execute GOSUB command
 void executeGosub(Token *tokens, int numTokens) {
     if (numTokens < 2 || tokens[1].type != TOKEN_NUMBER) {
-        printf("Invalid GOSUB statement\n");
+        outPrintf("Invalid GOSUB statement\n");
         return;
     }
 
-    int targetLine = atoi(tokens[1].value);
-    int targetIndex = findLineIndex(targetLine);
+    int targetIndex = resolveJumpTarget(&tokens[1]);
 
     if (targetIndex != -1) {
         if (gosubStackPtr < MAX_GOSUB_STACK) {
-            gosubStack[gosubStackPtr++] = currentLine + 1;
+            gosubStack[gosubStackPtr].returnLine = currentLine;
+            gosubStack[gosubStackPtr].returnStatement = currentStatement + 1;
+            gosubStack[gosubStackPtr++].loopDepth = loopStackPtr;
+            if ((uint64_t)gosubStackPtr > stats.gosubHighWater) {
+                stats.gosubHighWater = gosubStackPtr;
+            }
             nextLine = targetIndex;
+            nextStatement = 0;
         } else {
-            printf("GOSUB stack overflow\n");
+            outPrintf("GOSUB stack overflow\n");
         }
     } else {
-        printf("Undefined line %d\n", targetLine);
+        outPrintf("Undefined line %s\n", tokens[1].value);
+    }
+}
+
+// Execute ON expr GOTO/GOSUB line1, line2, ...
+void executeOn(Token *tokens, int numTokens) {
+    int jumpIndex = -1;
+    for (int i = 1; i < numTokens; i++) {
+        if (tokens[i].keyword == KW_GOTO || tokens[i].keyword == KW_GOSUB) {
+            jumpIndex = i;
+            break;
+        }
+    }
+    if (jumpIndex < 2 || jumpIndex == numTokens - 1) {
+        outPrintf("Invalid ON statement\n");
+        return;
+    }
+
+    // Range-check before converting, so a huge selector cannot overflow the int
+    int count = (numTokens - jumpIndex) / 2;
+    double selector = evaluateExpression(tokens + 1, jumpIndex - 1);
+    if (!(selector >= 1 && selector < count + 1)) {
+        return; // Out of range (or NaN): fall through, as in Commodore BASIC
+    }
+    int choice = (int)selector;
+
+    // The nth target is at jumpIndex + 2n - 1; the token before it (GOTO/GOSUB
+    // or a comma) makes a two-token view shaped like "GOTO n"
+    int targetIndex = jumpIndex + 2 * choice - 1;
+    if (tokens[jumpIndex].keyword == KW_GOTO) {
+        executeGoto(tokens + targetIndex - 1, 2);
+    } else {
+        executeGosub(tokens + targetIndex - 1, 2);
     }
 }
 
 // Execute RETURN command
 void executeReturn() {
     if (gosubStackPtr > 0) {
-        nextLine = gosubStack[--gosubStackPtr];
+        // Loops opened inside the subroutine end with it
+        gosubStackPtr--;
+        nextLine = gosubStack[gosubStackPtr].returnLine;
+        nextStatement = gosubStack[gosubStackPtr].returnStatement;
+        loopStackPtr = gosubStack[gosubStackPtr].loopDepth;
     } else {
-        printf("RETURN without GOSUB\n");
+        outPrintf("RETURN without GOSUB\n");
+    }
+}
+
+// Execute SAVE "file": write the program as a binary image, which
+// cbsh can then run without lexing it (cbsh file)
+void executeSave(Token *tokens, int numTokens) {
+    if (numTokens != 2 || tokens[1].type != TOKEN_STRING) {
+        outPrintf("Invalid SAVE statement, try SAVE \"file\"\n");
+        return;
     }
+    saveImage(tokens[1].value, 0, true);
 }
 
 // Execute END command
 void executeEnd() {
     running = false;
+    outFlush();
     nextLine = 0;
 }
 
+// Settings that SET can switch between TRUE and FALSE
+static const struct {
+    const char *name;
+    bool *flag;
+} settings[] = {
+    {"emu_amiga_m68k", &emu_amiga_m68k},
+    {"bytecode", &useBytecode},
+    {"linebuffer", &lineBufferedOutput},
+    {"stats", &statsEnabled},
+};
+
 // Execute SET command
 void executeSet(Token *tokens, int numTokens) {
-    if (numTokens < 3 || tokens[1].type != TOKEN_IDENTIFIER || tokens[2].type != TOKEN_OPERATOR || strcmp(tokens[2].value, "=") != 0) {
-        printf("Invalid SET statement\n");
+    // A setting's name may also be a keyword (STATS)
+    if (numTokens < 3 || (tokens[1].type != TOKEN_IDENTIFIER && tokens[1].type != TOKEN_KEYWORD) || tokens[2].type != TOKEN_OPERATOR || strcmp(tokens[2].value, "=") != 0) {
+        outPrintf("Invalid SET statement\n");
         return;
     }
 
-    if (strcasecmp(tokens[1].value, "emu_amiga_m68k") == 0) {
-        if (numTokens > 3 && tokens[3].type == TOKEN_IDENTIFIER) {
-            if (strcasecmp(tokens[3].value, "TRUE") == 0) {
-                emu_amiga_m68k = true;
-                printf("emu_amiga_m68k set to TRUE\n");
-            } else if (strcasecmp(tokens[3].value, "FALSE") == 0) {
-                emu_amiga_m68k = false;
-                printf("emu_amiga_m68k set to FALSE\n");
-            } else {
-                printf("Invalid value for emu_amiga_m68k\n");
-            }
+    for (size_t i = 0; i < sizeof(settings) / sizeof(settings[0]); i++) {
+        if (strcasecmp(tokens[1].value, settings[i].name) != 0) {
+            continue;
+        }
+        if (numTokens > 3 && tokens[3].type == TOKEN_IDENTIFIER && strcasecmp(tokens[3].value, "TRUE") == 0) {
+            *settings[i].flag = true;
+            outPrintf("%s set to TRUE\n", settings[i].name);
+        } else if (numTokens > 3 && tokens[3].type == TOKEN_IDENTIFIER && strcasecmp(tokens[3].value, "FALSE") == 0) {
+            *settings[i].flag = false;
+            outPrintf("%s set to FALSE\n", settings[i].name);
         } else {
-            printf("Invalid value for emu_amiga_m68k\n");
+            outPrintf("Invalid value for %s\n", settings[i].name);
         }
-    } else {
-        printf("Unknown variable in SET statement\n");
+        return;
     }
+    outPrintf("Unknown variable in SET statement\n");
 }
 
-// Execute a line of BASIC code
-void executeLine(Line *line) {
-    if (line->numTokens == 0) {
+// Execute one statement given as a view (pointer, count) into a line's
+// tokens, so IF/THEN and ON can dispatch into part of a line without copying
+void executeStatement(Token *tokens, int numTokens) {
+    if (numTokens == 0) {
         return;
     }
 
-    switch (line->tokens[0].keyword) {
+    switch (tokens[0].keyword) {
         case KW_REM:
             // Comment, do nothing
             break;
+        case KW_STATS:
+            executeStats();
+            break;
         case KW_LET:
-            executeLet(line->tokens, line->numTokens);
+            executeLet(tokens, numTokens);
             break;
         case KW_PRINT:
-            executePrint(line->tokens, line->numTokens);
+            executePrint(tokens, numTokens);
             break;
         case KW_LOAD: // Add this case
-            executeLoad(line->tokens, line->numTokens);
+            executeLoad(tokens, numTokens);
             break;
         case KW_DIR: 
             executeDir();
             break;
+        case KW_JOBS:
+            executeJobs();
+            break;
+        case KW_WAIT:
+            executeWait(tokens, numTokens);
+            break;
         case KW_INPUT:
-            executeInput(line->tokens, line->numTokens);
+            executeInput(tokens, numTokens);
             break;
         case KW_IF:
-            executeIf(line->tokens, line->numTokens);
+            executeIf(tokens, numTokens);
             break;
         case KW_FOR:
-            executeFor(line->tokens, line->numTokens);
+            executeFor(tokens, numTokens);
             break;
         case KW_NEXT:
-            executeNext(line->tokens, line->numTokens);
+            executeNext(tokens, numTokens);
             break;
         case KW_GOTO:
-            executeGoto(line->tokens, line->numTokens);
+            executeGoto(tokens, numTokens);
             break;
         case KW_GOSUB:
-            executeGosub(line->tokens, line->numTokens);
+            executeGosub(tokens, numTokens);
+            break;
+        case KW_ON:
+            executeOn(tokens, numTokens);
             break;
         case KW_RETURN:
             executeReturn();
             break;
+        case KW_SAVE:
+            executeSave(tokens, numTokens);
+            break;
         case KW_DATA:
-            executeData(line->tokens, line->numTokens);
+            executeData(tokens, numTokens);
+            break;
+        case KW_MAT:
+            executeMat(tokens, numTokens);
+            break;
+        case KW_DIM:
+            executeDim(tokens, numTokens);
             break;
         case KW_READ:
-            executeRead(line->tokens, line->numTokens);
+            executeRead(tokens, numTokens);
             break;
         case KW_ADD:
-    if (line->numTokens >= 3) {
-        executeAdd(line->tokens[1].value, line->tokens[2].value);
+    if (numTokens >= 3) {
+        executeAdd(&tokens[1], &tokens[2]);
     } else {
-        printf("Syntax error: ADD requires two arguments\n");
+        outPrintf("Syntax error: ADD requires two arguments\n");
     }
     break;
 
 case KW_SUB:
-    if (line->numTokens >= 3) {
-        executeSub(line->tokens[1].value, line->tokens[2].value);
+    if (numTokens >= 3) {
+        executeSub(&tokens[1], &tokens[2]);
     } else {
-        printf("Syntax error: SUB requires two arguments\n");
+        outPrintf("Syntax error: SUB requires two arguments\n");
     }
     break;
 
 case KW_DIV:
-    if (line->numTokens >= 3) {
-        executeDiv(line->tokens[1].value, line->tokens[2].value);
+    if (numTokens >= 3) {
+        executeDiv(&tokens[1], &tokens[2]);
     } else {
-        printf("Syntax error: DIV requires two arguments\n");
+        outPrintf("Syntax error: DIV requires two arguments\n");
     }
     break;
 
 case KW_FLOOR:
-    if (line->numTokens >= 2) {
-        executeFloor(line->tokens[1].value);
+    if (numTokens >= 2) {
+        executeFloor(&tokens[1]);
     } else {
-        printf("Syntax error: FLOOR requires one argument\n");
+        outPrintf("Syntax error: FLOOR requires one argument\n");
     }
     break;
         case KW_RESTORE:
-            executeRestore();
+            executeRestore(tokens, numTokens);
             break;
         case KW_END:
             executeEnd();
             break;
         case KW_SET:
-            executeSet(line->tokens, line->numTokens);
+            executeSet(tokens, numTokens);
             break;
         case KW_NONE:
-            if (line->tokens[0].type == TOKEN_IDENTIFIER) {
+            if (tokens[0].type == TOKEN_IDENTIFIER) {
                 // Implicit LET
-                executeLet(line->tokens, line->numTokens);
-            } else if (line->tokens[0].type == TOKEN_NUMBER) {
-                printf("Syntax error\n");
+                executeLet(tokens, numTokens);
+            } else if (tokens[0].type == TOKEN_NUMBER) {
+                outPrintf("Syntax error\n");
             } else {
-                printf("Unimplemented command: %s\n", line->tokens[0].value);
+                outPrintf("Unimplemented command: %s\n", tokens[0].value);
             }
             break;
         default:
-            printf("Unimplemented command: %s\n", line->tokens[0].value);
+            outPrintf("Unimplemented command: %s\n", tokens[0].value);
             break;
     }
 }
@@ -0,0 +1,128 @@
+#include "cbsh.h"
+
+// DATA pool. Every DATA statement in the program is collected once, in line
+// order, into one growable array of items before the program runs, so READ
+// is an array access and the program can READ values whose DATA line has
+// not run (or never runs). dataLineStart maps each program line to its first
+// item, which makes RESTORE <line> a table lookup. Rebuilt only after edits.
+
+static int *dataLineStart = NULL; // Index of the first item at or after each line, plus one for the end
+static unsigned int dataGeneration = 0; // programGeneration the pool was built for
+
+// Append an item to the pool
+static void addDataItem(const char *text, double number, bool isNumber) {
+    if (numDataItems == dataItemsCapacity) {
+        int newCapacity = dataItemsCapacity ? dataItemsCapacity * 2 : 256;
+        DataItem *newItems = realloc(dataItems, newCapacity * sizeof(DataItem));
+        if (!newItems) {
+            perror("realloc");
+            exit(1);
+        }
+        dataItems = newItems;
+        dataItemsCapacity = newCapacity;
+    }
+    DataItem *item = &dataItems[numDataItems++];
+    item->text = text;
+    item->length = strlen(text);
+    item->number = number;
+    item->isNumber = isNumber;
+}
+
+// Add one comma-separated DATA item: a string, a number or a signed number.
+// The lexer keeps an unquoted item's text as written in one string token, so
+// only a sign and its number arrive as several tokens.
+static void addDataTokens(Token *tokens, int numTokens) {
+    if (numTokens == 0) {
+        addDataItem("", 0, true); // Empty item: 0, or "" when read as a string
+        return;
+    }
+    if (numTokens == 1 && tokens[0].type == TOKEN_STRING) {
+        addDataItem(tokens[0].value, 0, false);
+        return;
+    }
+    if (numTokens == 1 && tokens[0].type == TOKEN_NUMBER) {
+        addDataItem(tokens[0].value, tokens[0].number, true);
+        return;
+    }
+
+    // A signed number reads back as "-5", not "- 5"
+    bool isSigned = numTokens == 2 && tokens[1].type == TOKEN_NUMBER && tokens[0].type == TOKEN_OPERATOR &&
+                    (strcmp(tokens[0].value, "-") == 0 || strcmp(tokens[0].value, "+") == 0);
+    size_t size = 1;
+    for (int i = 0; i < numTokens; i++) {
+        size += strlen(tokens[i].value) + 1;
+    }
+    char *text = malloc(size);
+    if (!text) {
+        perror("malloc");
+        exit(1);
+    }
+    size_t len = 0;
+    for (int i = 0; i < numTokens; i++) {
+        if (i > 0 && !isSigned) {
+            text[len++] = ' ';
+        }
+        size_t tokenLength = strlen(tokens[i].value);
+        memcpy(text + len, tokens[i].value, tokenLength);
+        len += tokenLength;
+    }
+    if (isSigned) {
+        double number = tokens[0].value[0] == '-' ? -tokens[1].number : tokens[1].number;
+        addDataItem(internString(text, len), number, true);
+    } else {
+        addDataItem(internString(text, len), 0, false);
+    }
+    free(text);
+}
+
+// Collect the DATA items of every line, unless the pool is still current
+void prepareData() {
+    if (dataGeneration == programGeneration && dataLineStart) {
+        return;
+    }
+    numDataItems = 0;
+    free(dataLineStart);
+    dataLineStart = malloc((numLines + 1) * sizeof(int));
+    if (!dataLineStart) {
+        perror("malloc");
+        exit(1);
+    }
+
+    for (int i = 0; i < numLines; i++) {
+        Line *line = program[i];
+        dataLineStart[i] = numDataItems;
+        for (int s = 0; s < line->numStatements; s++) {
+            Token *tokens = line->tokens + line->statements[s];
+            int numTokens = line->statements[s + 1] - line->statements[s] - 1;
+            if (numTokens == 0 || tokens[0].keyword != KW_DATA) {
+                continue;
+            }
+            int start = 1;
+            for (int t = 1; t <= numTokens; t++) {
+                if (t == numTokens || (tokens[t].type == TOKEN_OPERATOR && strcmp(tokens[t].value, ",") == 0)) {
+                    addDataTokens(tokens + start, t - start);
+                    start = t + 1;
+                }
+            }
+        }
+    }
+    dataLineStart[numLines] = numDataItems;
+    dataReadPtr = 0; // The old position means nothing in the new pool
+    dataGeneration = programGeneration;
+}
+
+// Next item for READ, or NULL when the DATA is used up
+DataItem *nextDataItem() {
+    prepareData();
+    if (dataReadPtr >= numDataItems) {
+        return NULL;
+    }
+    stats.dataReads++;
+    return &dataItems[dataReadPtr++];
+}
+
+// Make READ continue from the first DATA item at or after a line index
+void restoreData(int lineIndex) {
+    prepareData();
+    dataReadPtr = dataLineStart[lineIndex];
+}
@@ -1,24 +1,762 @@
 #include "cbsh.h"
 
-// Evaluate an expression (handle only basic arithmetic for now)
+// Expressions are compiled once into postfix code by a precedence-climbing
+// parser and cached on the first token of the span, so every later
+// evaluation just runs the code over a small value stack. An array element
+// compiles to its subscript expressions followed by one OP_ELEMENT, which
+// turns them into an offset into the array's storage.
+//
+// Precedence, loosest first (as in Commodore BASIC):
+//   OR, AND, NOT, relational (= <> < > <= >=), + -, * /, unary -, ^
+
+#define MAX_EXPR_DEPTH 64
+
+enum {
+    PREC_OR = 1,
+    PREC_AND,
+    PREC_NOT,
+    PREC_RELATIONAL,
+    PREC_ADDITIVE,
+    PREC_MULTIPLICATIVE,
+    PREC_UNARY,
+    PREC_POWER
+};
+
+typedef struct {
+    Token *tokens;
+    int pos;
+    int end;
+    ExprInstr *code;
+    int length;
+    int capacity;
+    int depth;
+    int maxDepth;
+    bool report; // Print syntax errors (the VM compiles quietly and falls back)
+} Parser;
+
+static bool parseBinary(Parser *p, int minPrec);
+
+// Append an instruction, tracking how deep the value stack gets
+static ExprInstr *emit(Parser *p, ExprOp op, int stackEffect) {
+    if (p->length == p->capacity) {
+        int newCapacity = p->capacity ? p->capacity * 2 : 16;
+        ExprInstr *newCode = realloc(p->code, newCapacity * sizeof(ExprInstr));
+        if (!newCode) {
+            perror("realloc");
+            exit(1);
+        }
+        p->code = newCode;
+        p->capacity = newCapacity;
+    }
+    ExprInstr *instr = &p->code[p->length++];
+    memset(instr, 0, sizeof(ExprInstr));
+    instr->op = op;
+    p->depth += stackEffect;
+    if (p->depth > p->maxDepth) {
+        p->maxDepth = p->depth;
+    }
+    return instr;
+}
+
+// Report a syntax error unless compiling quietly
+static bool syntaxError(Parser *p, const char *message, const char *detail) {
+    if (p->report) {
+        outPrintf("Syntax error: %s%s\n", message, detail);
+    }
+    return false;
+}
+
+static bool isOperator(Token *token, const char *op) {
+    return token->type == TOKEN_OPERATOR && strcmp(token->value, op) == 0;
+}
+
+// Map a token to a binary operator and its precedence, or return false
+static bool binaryOperator(Token *token, ExprOp *op, int *prec) {
+    if (token->type == TOKEN_KEYWORD) {
+        if (token->keyword == KW_AND) { *op = OP_AND; *prec = PREC_AND; return true; }
+        if (token->keyword == KW_OR) { *op = OP_OR; *prec = PREC_OR; return true; }
+        return false;
+    }
+    if (token->type != TOKEN_OPERATOR) {
+        return false;
+    }
+    const char *v = token->value;
+    switch (v[0]) {
+        case '+': *op = OP_ADD; *prec = PREC_ADDITIVE; return true;
+        case '-': *op = OP_SUBTRACT; *prec = PREC_ADDITIVE; return true;
+        case '*': *op = OP_MULTIPLY; *prec = PREC_MULTIPLICATIVE; return true;
+        case '/': *op = OP_DIVIDE; *prec = PREC_MULTIPLICATIVE; return true;
+        case '^': *op = OP_POWER; *prec = PREC_POWER; return true;
+        case '=': *op = OP_EQUAL; *prec = PREC_RELATIONAL; return true;
+        case '<':
+            *op = v[1] == '>' ? OP_NOT_EQUAL : v[1] == '=' ? OP_LESS_EQUAL : OP_LESS;
+            *prec = PREC_RELATIONAL;
+            return true;
+        case '>':
+            *op = v[1] == '=' ? OP_GREATER_EQUAL : OP_GREATER;
+            *prec = PREC_RELATIONAL;
+            return true;
+    }
+    return false;
+}
+
+// Array element: NAME(subscript, ...)
+static bool parseElement(Parser *p) {
+    Token *token = &p->tokens[p->pos];
+    if (token->slot < 0) {
+        token->slot = getArraySlot(token->value);
+    }
+    p->pos += 2;
+    int count = 0;
+    do {
+        if (count > 0) {
+            p->pos++; // The comma
+        }
+        if (!parseBinary(p, PREC_OR)) {
+            return false;
+        }
+        count++;
+    } while (p->pos < p->end && isOperator(&p->tokens[p->pos], ","));
+    if (p->pos >= p->end || !isOperator(&p->tokens[p->pos], ")")) {
+        return syntaxError(p, "missing )", "");
+    }
+    p->pos++;
+    if (count > MAX_DIMENSIONS) {
+        return syntaxError(p, "too many subscripts for ", token->value);
+    }
+    ExprInstr *instr = emit(p, OP_ELEMENT, 1 - count);
+    instr->slot = token->slot;
+    instr->count = count;
+    return true;
+}
+
+// SGN(x): -1, 0 or 1
+static double sign(double x) {
+    return (x > 0) - (x < 0);
+}
+
+// Built-in functions taking expression arguments. The numeric intrinsics
+// compile to one OP_MATH holding a pointer to the C function, so a call
+// costs an indirect call, with no lookup by name when it runs.
+typedef struct {
+    Keyword keyword;
+    ExprOp op;
+    int minArgs;
+    int maxArgs;
+    double (*math)(double); // OP_MATH
+} BuiltinFunction;
+
+static const BuiltinFunction functionTable[] = {
+    {KW_LEN, OP_LEN, 1, 1, NULL},
+    {KW_LEFT, OP_LEFT, 2, 2, NULL},
+    {KW_RIGHT, OP_RIGHT, 2, 2, NULL},
+    {KW_MID, OP_MID, 2, 3, NULL},
+    {KW_INSTR, OP_INSTR, 2, 3, NULL},
+    {KW_SQR, OP_MATH, 1, 1, sqrt},
+    {KW_SIN, OP_MATH, 1, 1, sin},
+    {KW_COS, OP_MATH, 1, 1, cos},
+    {KW_ATN, OP_MATH, 1, 1, atan},
+    {KW_EXP, OP_MATH, 1, 1, exp},
+    {KW_LOG, OP_MATH, 1, 1, log},
+    {KW_ABS, OP_MATH, 1, 1, fabs},
+    {KW_INT, OP_MATH, 1, 1, floor},
+    {KW_SGN, OP_MATH, 1, 1, sign},
+    {KW_RND, OP_MATH, 1, 1, randomNumber},
+};
+
+#define NUM_FUNCTIONS (int)(sizeof(functionTable) / sizeof(functionTable[0]))
+
+// Function call: NAME(argument, ...), arguments left on the stack in order
+static bool parseCall(Parser *p, const BuiltinFunction *function) {
+    Token *token = &p->tokens[p->pos];
+    p->pos++;
+    if (p->pos >= p->end || !isOperator(&p->tokens[p->pos], "(")) {
+        return syntaxError(p, "missing ( after ", token->value);
+    }
+    int count = 0;
+    do {
+        p->pos++; // The ( or comma
+        if (!parseBinary(p, PREC_OR)) {
+            return false;
+        }
+        count++;
+    } while (p->pos < p->end && isOperator(&p->tokens[p->pos], ","));
+    if (p->pos >= p->end || !isOperator(&p->tokens[p->pos], ")")) {
+        return syntaxError(p, "missing )", "");
+    }
+    p->pos++;
+    if (count < function->minArgs || count > function->maxArgs) {
+        return syntaxError(p, "wrong number of arguments to ", token->value);
+    }
+    ExprInstr *instr = emit(p, function->op, 1 - count);
+    instr->count = count;
+    instr->math = function->math;
+    instr->string = token->value;
+    return true;
+}
+
+// Reduction over whole arrays: SUM(A) or DOT(A, B)
+static bool parseReduction(Parser *p) {
+    Token *token = &p->tokens[p->pos];
+    int numArrays = token->keyword == KW_DOT ? 2 : 1;
+    int slots[2] = {-1, -1};
+    int pos = p->pos + 1;
+    if (pos >= p->end || !isOperator(&p->tokens[pos], "(")) {
+        return syntaxError(p, "missing ( after ", token->value);
+    }
+    pos++;
+    for (int i = 0; i < numArrays; i++) {
+        if (i > 0) {
+            if (pos >= p->end || !isOperator(&p->tokens[pos], ",")) {
+                return syntaxError(p, "missing , in ", token->value);
+            }
+            pos++;
+        }
+        if (pos >= p->end || p->tokens[pos].type != TOKEN_IDENTIFIER) {
+            return syntaxError(p, "expected an array name in ", token->value);
+        }
+        slots[i] = getArraySlot(p->tokens[pos].value);
+        pos++;
+    }
+    if (pos >= p->end || !isOperator(&p->tokens[pos], ")")) {
+        return syntaxError(p, "missing )", "");
+    }
+    p->pos = pos + 1;
+    ExprInstr *instr = emit(p, numArrays == 2 ? OP_DOT : OP_SUM, 1);
+    instr->slot = slots[0];
+    instr->other = slots[1];
+    return true;
+}
+
+// Operand: literal, variable, array element or parenthesized expression
+static bool parsePrimary(Parser *p) {
+    if (p->pos >= p->end) {
+        return syntaxError(p, "missing operand", "");
+    }
+    Token *token = &p->tokens[p->pos];
+    switch (token->type) {
+        case TOKEN_NUMBER:
+            emit(p, OP_NUMBER, 1)->number = token->number;
+            p->pos++;
+            return true;
+        case TOKEN_STRING: {
+            ExprInstr *instr = emit(p, OP_STRING, 1);
+            instr->string = token->value;
+            instr->count = strlen(token->value);
+            p->pos++;
+            return true;
+        }
+        case TOKEN_IDENTIFIER:
+            if (p->pos + 1 < p->end && isOperator(&p->tokens[p->pos + 1], "(")) {
+                return parseElement(p);
+            }
+            if (token->slot < 0) {
+                token->slot = getVariableSlot(token->value);
+            }
+            // The slot's type cannot change while this code is valid
+            switch (variableInfo[token->slot].type) {
+                case VAR_TYPE_NUMERIC: emit(p, OP_VARIABLE, 1)->slot = token->slot; break;
+                case VAR_TYPE_INTEGER: emit(p, OP_INTEGER_VARIABLE, 1)->slot = token->slot; break;
+                case VAR_TYPE_STRING: emit(p, OP_STRING_VARIABLE, 1)->slot = token->slot; break;
+            }
+            p->pos++;
+            return true;
+        case TOKEN_KEYWORD:
+            if (token->keyword == KW_SUM || token->keyword == KW_DOT) {
+                return parseReduction(p);
+            }
+            for (int i = 0; i < NUM_FUNCTIONS; i++) {
+                if (functionTable[i].keyword == token->keyword) {
+                    return parseCall(p, &functionTable[i]);
+                }
+            }
+            break;
+        case TOKEN_OPERATOR:
+            if (isOperator(token, "(")) {
+                p->pos++;
+                if (!parseBinary(p, PREC_OR)) {
+                    return false;
+                }
+                if (p->pos >= p->end || !isOperator(&p->tokens[p->pos], ")")) {
+                    return syntaxError(p, "missing )", "");
+                }
+                p->pos++;
+                return true;
+            }
+            break;
+        default:
+            break;
+    }
+    return syntaxError(p, "unexpected ", token->value);
+}
+
+// Prefix operators, then an operand
+static bool parseUnary(Parser *p) {
+    if (p->pos < p->end) {
+        Token *token = &p->tokens[p->pos];
+        if (isOperator(token, "-")) {
+            p->pos++;
+            if (!parseBinary(p, PREC_POWER)) {
+                return false;
+            }
+            emit(p, OP_NEGATE, 0);
+            return true;
+        }
+        if (isOperator(token, "+")) {
+            p->pos++;
+            return parseBinary(p, PREC_POWER);
+        }
+        if (token->keyword == KW_NOT) {
+            p->pos++;
+            if (!parseBinary(p, PREC_RELATIONAL)) {
+                return false;
+            }
+            emit(p, OP_NOT, 0);
+            return true;
+        }
+    }
+    return parsePrimary(p);
+}
+
+// Precedence climbing: binary operators binding at least as tight as minPrec
+static bool parseBinary(Parser *p, int minPrec) {
+    if (!parseUnary(p)) {
+        return false;
+    }
+    while (p->pos < p->end) {
+        ExprOp op;
+        int prec;
+        if (!binaryOperator(&p->tokens[p->pos], &op, &prec) || prec < minPrec) {
+            break;
+        }
+        p->pos++;
+        if (!parseBinary(p, prec + 1)) { // All operators are left-associative
+            return false;
+        }
+        emit(p, op, -1);
+    }
+    return true;
+}
+
+// Compile the start of a token span: the longest expression, or only an
+// operand when compiling an assignment target. Returns NULL (reporting the
+// error if asked to) if there is no valid code.
+static Expr *compileSpan(Token *tokens, int numTokens, bool reportErrors, bool operandOnly) {
+    Parser p;
+    memset(&p, 0, sizeof(p));
+    p.tokens = tokens;
+    p.end = numTokens;
+    p.report = reportErrors;
+
+    if (!(operandOnly ? parsePrimary(&p) : parseBinary(&p, PREC_OR))) {
+        free(p.code);
+        return NULL;
+    }
+    if (p.maxDepth > MAX_EXPR_DEPTH) {
+        if (reportErrors) {
+            outPrintf("Expression too complex\n");
+        }
+        free(p.code);
+        return NULL;
+    }
+
+    Expr *expr = malloc(sizeof(Expr) + p.length * sizeof(ExprInstr));
+    stats.allocations++;
+    if (!expr) {
+        perror("malloc");
+        free(p.code);
+        return NULL;
+    }
+    expr->numTokens = numTokens;
+    expr->consumed = p.pos;
+    expr->symbolGeneration = symbolGeneration;
+    expr->maxDepth = p.maxDepth;
+    expr->length = p.length;
+    memcpy(expr->code, p.code, p.length * sizeof(ExprInstr));
+    free(p.code);
+    return expr;
+}
+
+// Compile the longest expression at the start of a token span.
+// Returns NULL (reporting the error if asked to) if there is no valid expression.
+Expr *compileExpression(Token *tokens, int numTokens, bool reportErrors) {
+    return compileSpan(tokens, numTokens, reportErrors, false);
+}
+
+// Compile the array element an assignment at the start of a span writes to.
+// Returns NULL (reporting the error if asked to) if it is not one.
+Expr *compileTarget(Token *tokens, int numTokens, bool reportErrors) {
+    if (numTokens < 2 || tokens[0].type != TOKEN_IDENTIFIER || !isOperator(&tokens[1], "(")) {
+        if (reportErrors) {
+            outPrintf("Syntax error: expected an array element\n");
+        }
+        return NULL;
+    }
+    return compileSpan(tokens, numTokens, reportErrors, true);
+}
+
+// Compiled expression for a token span, compiling it on first use
+static Expr *cachedExpression(Token *tokens, int numTokens) {
+    if (numTokens <= 0) {
+        outPrintf("Syntax error: missing expression\n");
+        return NULL;
+    }
+    Expr *expr = tokens[0].expr;
+    if (expr && expr->numTokens == numTokens && expr->symbolGeneration == symbolGeneration) {
+        return expr;
+    }
+    free(expr);
+    tokens[0].expr = compileExpression(tokens, numTokens, true);
+    return tokens[0].expr;
+}
+
+// Convert to an integer for AND/OR/NOT, saturating instead of overflowing
+static long long toInteger(double value) {
+    if (value >= 9.2e18) return LLONG_MAX;
+    if (value <= -9.2e18) return LLONG_MIN;
+    return (long long)floor(value);
+}
+
+// Compare two values of the same type: <0, 0 or >0
+static int compareValues(Value *a, Value *b) {
+    if (a->type == VAR_TYPE_STRING) {
+        return stringCompare(&a->str, &b->str);
+    }
+    return (a->num > b->num) - (a->num < b->num);
+}
+
+// Drop the reference a value holds, if it owns one
+void releaseValue(Value *value) {
+    if (value->type == VAR_TYPE_STRING && value->owned) {
+        stringRelease(&value->str);
+        value->owned = false;
+    }
+}
+
+// Give up on an evaluation: release what the stack holds
+static int failCode(Value *stack, int sp) {
+    for (int i = 0; i < sp; i++) {
+        releaseValue(&stack[i]);
+    }
+    return -1;
+}
+
+// Convert a count argument of LEFT$, RIGHT$ or MID$, at most max. -1 if negative.
+static int countArgument(double value, int max) {
+    if (!(value >= 0)) {
+        return -1;
+    }
+    return value > max ? max : (int)value;
+}
+
+// Run a string function on its arguments, leaving the result in args[0].
+// Slices share the source string's storage (and its ownership). Returns
+// false (after reporting) on a bad argument; the caller releases them.
+static bool callStringFunction(ExprOp op, Value *args, int count) {
+    Value *s = &args[0];
+    if (op == OP_LEN) {
+        if (s->type != VAR_TYPE_STRING) {
+            outPrintf("Type mismatch\n");
+            return false;
+        }
+        int length = s->str.length;
+        releaseValue(s);
+        s->type = VAR_TYPE_NUMERIC;
+        s->num = length;
+        return true;
+    }
+
+    if (op == OP_INSTR) {
+        // INSTR(text, pattern) or INSTR(start, text, pattern)
+        Value *text = &args[count - 2];
+        Value *pattern = &args[count - 1];
+        double from = count == 3 && args[0].type == VAR_TYPE_NUMERIC ? args[0].num : 1;
+        if ((count == 3 && args[0].type != VAR_TYPE_NUMERIC) || text->type != VAR_TYPE_STRING ||
+            pattern->type != VAR_TYPE_STRING) {
+            outPrintf("Type mismatch\n");
+            return false;
+        }
+        if (!(from >= 1)) {
+            outPrintf("Illegal quantity in INSTR\n");
+            return false;
+        }
+        int position = from > text->str.length + 1 ? -1 : stringFind(&text->str, &pattern->str, (int)from - 1);
+        releaseValue(text);
+        releaseValue(pattern);
+        args[0].type = VAR_TYPE_NUMERIC;
+        args[0].num = position + 1; // 0 when not found
+        return true;
+    }
+
+    // LEFT$(s, n), RIGHT$(s, n), MID$(s, start[, n])
+    if (s->type != VAR_TYPE_STRING || args[1].type != VAR_TYPE_NUMERIC ||
+        (count == 3 && args[2].type != VAR_TYPE_NUMERIC)) {
+        outPrintf("Type mismatch\n");
+        return false;
+    }
+    int length = s->str.length;
+    int start;
+    int n;
+    if (op == OP_MID) {
+        if (!(args[1].num >= 1)) {
+            outPrintf("Illegal quantity in MID$\n");
+            return false;
+        }
+        start = args[1].num > length ? length : (int)args[1].num - 1;
+        n = count == 3 ? countArgument(args[2].num, length - start) : length - start;
+    } else {
+        n = countArgument(args[1].num, length);
+        start = op == OP_LEFT ? 0 : length - n;
+    }
+    if (n < 0) {
+        outPrintf("Illegal quantity\n");
+        return false;
+    }
+    s->str = stringSlice(&s->str, start, n);
+    return true;
+}
+
+// Run the first length instructions of compiled code. Returns the depth of
+// the value stack, or -1 (after reporting) on a type or subscript error.
+static inline int runCode(Expr *expr, int length, Value *stack) {
+    int sp = 0;
+
+    for (int pc = 0; pc < length; pc++) {
+        ExprInstr *instr = &expr->code[pc];
+        switch (instr->op) {
+            case OP_NUMBER:
+                stack[sp].type = VAR_TYPE_NUMERIC;
+                stack[sp++].num = instr->number;
+                break;
+            case OP_STRING:
+                stack[sp].type = VAR_TYPE_STRING;
+                stack[sp].owned = false;
+                stack[sp++].str = stringLiteral(instr->string, instr->count);
+                break;
+            case OP_VARIABLE:
+                stack[sp].type = VAR_TYPE_NUMERIC;
+                stack[sp++].num = numValues[instr->slot];
+                break;
+            case OP_INTEGER_VARIABLE:
+                stack[sp].type = VAR_TYPE_NUMERIC;
+                stack[sp++].num = (double)intValues[instr->slot];
+                break;
+            case OP_STRING_VARIABLE:
+                stack[sp].type = VAR_TYPE_STRING;
+                stack[sp].owned = false;
+                stack[sp++].str = strValues[instr->slot];
+                break;
+            case OP_ELEMENT: {
+                Target element;
+                sp -= instr->count;
+                if (!elementAddress(instr->slot, &stack[sp], instr->count, &element)) {
+                    return failCode(stack, sp + instr->count);
+                }
+                if (element.type == VAR_TYPE_NUMERIC) {
+                    stack[sp].type = VAR_TYPE_NUMERIC;
+                    stack[sp++].num = *element.num;
+                } else if (element.type == VAR_TYPE_INTEGER) {
+                    stack[sp].type = VAR_TYPE_NUMERIC;
+                    stack[sp++].num = (double)*element.integer;
+                } else {
+                    stack[sp].type = VAR_TYPE_STRING;
+                    stack[sp].owned = false;
+                    stack[sp++].str = *element.str;
+                }
+                break;
+            }
+            case OP_SUM:
+            case OP_DOT: {
+                double total;
+                bool ok = instr->op == OP_SUM ? arraySum(instr->slot, &total) : arrayDot(instr->slot, instr->other, &total);
+                if (!ok) {
+                    return failCode(stack, sp);
+                }
+                stack[sp].type = VAR_TYPE_NUMERIC;
+                stack[sp++].num = total;
+                break;
+            }
+            case OP_LEN:
+            case OP_LEFT:
+            case OP_RIGHT:
+            case OP_MID:
+            case OP_INSTR:
+                sp -= instr->count;
+                if (!callStringFunction(instr->op, &stack[sp], instr->count)) {
+                    return failCode(stack, sp + instr->count);
+                }
+                sp++;
+                break;
+            case OP_MATH: {
+                Value *arg = &stack[sp - 1];
+                if (arg->type != VAR_TYPE_NUMERIC) {
+                    outPrintf("Type mismatch\n");
+                    return failCode(stack, sp);
+                }
+                double result = instr->math(arg->num);
+                if (!isfinite(result) && isfinite(arg->num)) { // SQR(-1), LOG(0), EXP(1000)
+                    outPrintf("Illegal quantity in %s\n", instr->string);
+                    return failCode(stack, sp);
+                }
+                arg->num = result;
+                break;
+            }
+            case OP_NEGATE:
+            case OP_NOT:
+                if (stack[sp - 1].type != VAR_TYPE_NUMERIC) {
+                    outPrintf("Type mismatch\n");
+                    return failCode(stack, sp);
+                }
+                stack[sp - 1].num = instr->op == OP_NEGATE ? -stack[sp - 1].num : (double)~toInteger(stack[sp - 1].num);
+                break;
+            default: {
+                Value *a = &stack[sp - 2];
+                Value *b = &stack[sp - 1];
+                if (a->type != b->type) {
+                    outPrintf("Type mismatch\n");
+                    return failCode(stack, sp);
+                }
+                sp--;
+                if (instr->op >= OP_EQUAL && instr->op <= OP_GREATER_EQUAL) {
+                    int cmp = compareValues(a, b);
+                    bool truth;
+                    switch (instr->op) {
+                        case OP_EQUAL: truth = cmp == 0; break;
+                        case OP_NOT_EQUAL: truth = cmp != 0; break;
+                        case OP_LESS: truth = cmp < 0; break;
+                        case OP_GREATER: truth = cmp > 0; break;
+                        case OP_LESS_EQUAL: truth = cmp <= 0; break;
+                        default: truth = cmp >= 0; break;
+                    }
+                    releaseValue(a);
+                    releaseValue(b);
+                    a->type = VAR_TYPE_NUMERIC;
+                    a->num = truth ? -1 : 0; // Commodore BASIC truth values
+                    break;
+                }
+                if (a->type != VAR_TYPE_NUMERIC) {
+                    if (instr->op != OP_ADD) {
+                        outPrintf("Type mismatch\n");
+                        return failCode(stack, sp + 1);
+                    }
+                    bool ok = stringConcat(&a->str, &a->str, a->owned, &b->str);
+                    a->owned = ok;
+                    releaseValue(b);
+                    if (!ok) {
+                        return failCode(stack, sp);
+                    }
+                    break;
+                }
+                switch (instr->op) {
+                    case OP_ADD: a->num += b->num; break;
+                    case OP_SUBTRACT: a->num -= b->num; break;
+                    case OP_MULTIPLY: a->num *= b->num; break;
+                    case OP_DIVIDE:
+                        if (b->num == 0) {
+                            outPrintf("Division by zero\n");
+                            a->num = 0;
+                        } else {
+                            a->num /= b->num;
+                        }
+                        break;
+                    case OP_POWER: a->num = pow(a->num, b->num); break;
+                    case OP_AND: a->num = (double)(toInteger(a->num) & toInteger(b->num)); break;
+                    case OP_OR: a->num = (double)(toInteger(a->num) | toInteger(b->num)); break;
+                    default: break;
+                }
+                break;
+            }
+        }
+    }
+
+    return sp;
+}
+
+// Run compiled code. Returns false (after reporting) on a type error.
+bool evaluateCompiled(Expr *expr, Value *result) {
+    Value stack[MAX_EXPR_DEPTH];
+    if (runCode(expr, expr->length, stack) < 0) {
+        return false;
+    }
+    *result = stack[0];
+    return true;
+}
+
+// Address of the element a compiled target refers to
+bool evaluateTarget(Expr *expr, Target *target) {
+    Value stack[MAX_EXPR_DEPTH];
+    int sp = runCode(expr, expr->length - 1, stack);
+    if (sp < 0) {
+        return false;
+    }
+    ExprInstr *element = &expr->code[expr->length - 1];
+    if (!elementAddress(element->slot, stack + sp - element->count, element->count, target)) {
+        failCode(stack, sp);
+        return false;
+    }
+    return true;
+}
+
+// Find what an assignment at the start of a span writes to: a variable, or
+// an array element with its subscripts evaluated. consumed is set to the
+// number of tokens naming it.
+bool resolveTarget(Token *tokens, int numTokens, Target *target, int *consumed) {
+    if (numTokens <= 0 || tokens[0].type != TOKEN_IDENTIFIER) {
+        outPrintf("Syntax error: expected a variable\n");
+        return false;
+    }
+    if (numTokens < 2 || !isOperator(&tokens[1], "(")) {
+        variableTarget(assignableSlot(&tokens[0]), target);
+        *consumed = 1;
+        return true;
+    }
+
+    Expr *expr = tokens[0].expr;
+    if (!expr || expr->numTokens != numTokens || expr->symbolGeneration != symbolGeneration) {
+        free(expr);
+        expr = tokens[0].expr = compileTarget(tokens, numTokens, true);
+        if (!expr) {
+            return false;
+        }
+    }
+    *consumed = expr->consumed;
+    return evaluateTarget(expr, target);
+}
+
+
+// Evaluate the longest expression at the start of a span (e.g. one PRINT item)
+bool evaluatePrefix(Token *tokens, int numTokens, Value *result, int *consumed) {
+    Expr *expr = cachedExpression(tokens, numTokens);
+    if (!expr) {
+        return false;
+    }
+    *consumed = expr->consumed;
+    return evaluateCompiled(expr, result);
+}
+
+// Evaluate an expression that must span all the given tokens
+bool evaluateValue(Token *tokens, int numTokens, Value *result) {
+    Expr *expr = cachedExpression(tokens, numTokens);
+    if (!expr) {
+        return false;
+    }
+    if (expr->consumed != numTokens) {
+        outPrintf("Syntax error: unexpected %s\n", tokens[expr->consumed].value);
+        return false;
+    }
+    return evaluateCompiled(expr, result);
+}
+
+// Evaluate a numeric expression
 double evaluateExpression(Token *tokens, int numTokens) {
-    if (numTokens == 1) {
-        return getNumericValue(&tokens[0]);
-    } else if (numTokens == 3) {
-        double val1 = getNumericValue(&tokens[0]);
-        double val2 = getNumericValue(&tokens[2]);
-        if (strcmp(tokens[1].value, "+") == 0) return val1 + val2;
-        if (strcmp(tokens[1].value, "-") == 0) return val1 - val2;
-        if (strcmp(tokens[1].value, "*") == 0) return val1 * val2;
-        if (strcmp(tokens[1].value, "/") == 0) {
-            if (val2 == 0) {
-                printf("Division by zero\n");
-                return 0;
-            }
-            return val1 / val2;
-        }
-        // Handle more operators here (e.g., <, >, =)
-    }
-    printf("Invalid expression\n");
-    return 0;
+    Value value;
+    if (!evaluateValue(tokens, numTokens, &value)) {
+        return 0;
+    }
+    if (value.type != VAR_TYPE_NUMERIC) {
+        outPrintf("Type mismatch\n");
+        releaseValue(&value);
+        return 0;
+    }
+    return value.num;
 }
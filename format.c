@@ -0,0 +1,488 @@
+#include "cbsh.h"
+
+// Number formatting for PRINT. Numbers are printed the Commodore way (a
+// leading space or minus sign and a trailing space, no leading zero before
+// the point) using the shortest digits that read back as the same double.
+// Integers take a fast path; everything else goes through Grisu2, which
+// needs only 64-bit integer arithmetic and never touches the heap or the
+// locale. Also compiles and applies PRINT USING formats.
+
+// --- Grisu2 (Loitsch, "Printing Floating-Point Numbers Quickly and Accurately with Integers") ---
+
+typedef struct {
+    uint64_t f;
+    int e;
+} DiyFp; // f * 2^e
+
+typedef struct {
+    uint64_t f;
+    int e;
+    int k;
+} CachedPower; // Normalized 10^k = f * 2^e
+
+#define CACHED_POWERS_MIN_EXP -300
+#define CACHED_POWERS_STEP 8
+
+static const CachedPower cachedPowers[] = {
+    {0xAB70FE17C79AC6CA, -1060, -300}, {0xFF77B1FCBEBCDC4F, -1034, -292},
+    {0xBE5691EF416BD60C, -1007, -284}, {0x8DD01FAD907FFC3C,  -980, -276},
+    {0xD3515C2831559A83,  -954, -268}, {0x9D71AC8FADA6C9B5,  -927, -260},
+    {0xEA9C227723EE8BCB,  -901, -252}, {0xAECC49914078536D,  -874, -244},
+    {0x823C12795DB6CE57,  -847, -236}, {0xC21094364DFB5637,  -821, -228},
+    {0x9096EA6F3848984F,  -794, -220}, {0xD77485CB25823AC7,  -768, -212},
+    {0xA086CFCD97BF97F4,  -741, -204}, {0xEF340A98172AACE5,  -715, -196},
+    {0xB23867FB2A35B28E,  -688, -188}, {0x84C8D4DFD2C63F3B,  -661, -180},
+    {0xC5DD44271AD3CDBA,  -635, -172}, {0x936B9FCEBB25C996,  -608, -164},
+    {0xDBAC6C247D62A584,  -582, -156}, {0xA3AB66580D5FDAF6,  -555, -148},
+    {0xF3E2F893DEC3F126,  -529, -140}, {0xB5B5ADA8AAFF80B8,  -502, -132},
+    {0x87625F056C7C4A8B,  -475, -124}, {0xC9BCFF6034C13053,  -449, -116},
+    {0x964E858C91BA2655,  -422, -108}, {0xDFF9772470297EBD,  -396, -100},
+    {0xA6DFBD9FB8E5B88F,  -369,  -92}, {0xF8A95FCF88747D94,  -343,  -84},
+    {0xB94470938FA89BCF,  -316,  -76}, {0x8A08F0F8BF0F156B,  -289,  -68},
+    {0xCDB02555653131B6,  -263,  -60}, {0x993FE2C6D07B7FAC,  -236,  -52},
+    {0xE45C10C42A2B3B06,  -210,  -44}, {0xAA242499697392D3,  -183,  -36},
+    {0xFD87B5F28300CA0E,  -157,  -28}, {0xBCE5086492111AEB,  -130,  -20},
+    {0x8CBCCC096F5088CC,  -103,  -12}, {0xD1B71758E219652C,   -77,   -4},
+    {0x9C40000000000000,   -50,    4}, {0xE8D4A51000000000,   -24,   12},
+    {0xAD78EBC5AC620000,     3,   20}, {0x813F3978F8940984,    30,   28},
+    {0xC097CE7BC90715B3,    56,   36}, {0x8F7E32CE7BEA5C70,    83,   44},
+    {0xD5D238A4ABE98068,   109,   52}, {0x9F4F2726179A2245,   136,   60},
+    {0xED63A231D4C4FB27,   162,   68}, {0xB0DE65388CC8ADA8,   189,   76},
+    {0x83C7088E1AAB65DB,   216,   84}, {0xC45D1DF942711D9A,   242,   92},
+    {0x924D692CA61BE758,   269,  100}, {0xDA01EE641A708DEA,   295,  108},
+    {0xA26DA3999AEF774A,   322,  116}, {0xF209787BB47D6B85,   348,  124},
+    {0xB454E4A179DD1877,   375,  132}, {0x865B86925B9BC5C2,   402,  140},
+    {0xC83553C5C8965D3D,   428,  148}, {0x952AB45CFA97A0B3,   455,  156},
+    {0xDE469FBD99A05FE3,   481,  164}, {0xA59BC234DB398C25,   508,  172},
+    {0xF6C69A72A3989F5C,   534,  180}, {0xB7DCBF5354E9BECE,   561,  188},
+    {0x88FCF317F22241E2,   588,  196}, {0xCC20CE9BD35C78A5,   614,  204},
+    {0x98165AF37B2153DF,   641,  212}, {0xE2A0B5DC971F303A,   667,  220},
+    {0xA8D9D1535CE3B396,   694,  228}, {0xFB9B7CD9A4A7443C,   720,  236},
+    {0xBB764C4CA7A44410,   747,  244}, {0x8BAB8EEFB6409C1A,   774,  252},
+    {0xD01FEF10A657842C,   800,  260}, {0x9B10A4E5E9913129,   827,  268},
+    {0xE7109BFBA19C0C9D,   853,  276}, {0xAC2820D9623BF429,   880,  284},
+    {0x80444B5E7AA7CF85,   907,  292}, {0xBF21E44003ACDD2D,   933,  300},
+    {0x8E679C2F5E44FF8F,   960,  308}, {0xD433179D9C8CB841,   986,  316},
+    {0x9E19DB92B4E31BA9,  1013,  324},
+};
+
+static DiyFp diyFp(uint64_t f, int e) {
+    DiyFp x = {f, e};
+    return x;
+}
+
+static DiyFp diySub(DiyFp x, DiyFp y) {
+    return diyFp(x.f - y.f, x.e);
+}
+
+// Product rounded to the upper 64 bits
+static DiyFp diyMul(DiyFp x, DiyFp y) {
+    uint64_t xLo = x.f & 0xFFFFFFFFu, xHi = x.f >> 32;
+    uint64_t yLo = y.f & 0xFFFFFFFFu, yHi = y.f >> 32;
+    uint64_t p0 = xLo * yLo;
+    uint64_t p1 = xLo * yHi;
+    uint64_t p2 = xHi * yLo;
+    uint64_t p3 = xHi * yHi;
+    uint64_t q = (p0 >> 32) + (p1 & 0xFFFFFFFFu) + (p2 & 0xFFFFFFFFu) + (1u << 31);
+    return diyFp(p3 + (p1 >> 32) + (p2 >> 32) + (q >> 32), x.e + y.e + 64);
+}
+
+static DiyFp diyNormalize(DiyFp x) {
+    while ((x.f >> 63) == 0) {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+// Digits of value (positive, finite, non-zero) into digits[]; returns the
+// count, with value = digits * 10^*exponent
+static int grisu2(double value, char *digits, int *exponent) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint64_t fraction = bits & ((1ull << 52) - 1);
+    int biased = (int)(bits >> 52) & 0x7FF;
+
+    // value and the boundaries halfway to its neighbours
+    DiyFp v = biased == 0 ? diyFp(fraction, 1 - 1075) : diyFp(fraction | (1ull << 52), biased - 1075);
+    bool lowerCloser = fraction == 0 && biased > 1;
+    DiyFp plus = diyNormalize(diyFp(2 * v.f + 1, v.e - 1));
+    DiyFp minus = lowerCloser ? diyFp(4 * v.f - 1, v.e - 2) : diyFp(2 * v.f - 1, v.e - 1);
+    minus = diyFp(minus.f << (minus.e - plus.e), plus.e);
+    v = diyNormalize(v);
+
+    // Scale by a cached power of ten so the exponent lands in [-60, -32]
+    int f = -60 - plus.e - 1;
+    int k = (f * 78913) / (1 << 18) + (f > 0);
+    const CachedPower *cached = &cachedPowers[(-CACHED_POWERS_MIN_EXP + k + CACHED_POWERS_STEP - 1) / CACHED_POWERS_STEP];
+    DiyFp c = diyFp(cached->f, cached->e);
+    DiyFp w = diyMul(v, c);
+    DiyFp high = diyMul(plus, c);
+    DiyFp low = diyMul(minus, c);
+    high.f--;
+    low.f++;
+    *exponent = -cached->k;
+
+    // Generate digits until they identify a number inside (low, high)
+    uint64_t delta = diySub(high, low).f;
+    uint64_t dist = diySub(high, w).f;
+    int shift = -high.e;
+    uint64_t one = 1ull << shift;
+    uint32_t p1 = (uint32_t)(high.f >> shift);
+    uint64_t p2 = high.f & (one - 1);
+    int length = 0;
+    uint64_t rest, unit;
+
+    uint32_t pow10 = 1;
+    int n = 1;
+    while (n < 10 && p1 >= pow10 * 10) {
+        pow10 *= 10;
+        n++;
+    }
+    for (;;) {
+        if (n == 0) {
+            // Fractional digits
+            int m = 0;
+            do {
+                p2 *= 10;
+                digits[length++] = (char)('0' + (p2 >> shift));
+                p2 &= one - 1;
+                delta *= 10;
+                dist *= 10;
+                m++;
+            } while (p2 > delta);
+            *exponent -= m;
+            rest = p2;
+            unit = one;
+            break;
+        }
+        digits[length++] = (char)('0' + p1 / pow10);
+        p1 %= pow10;
+        n--;
+        rest = ((uint64_t)p1 << shift) + p2;
+        if (rest <= delta) {
+            *exponent += n;
+            unit = (uint64_t)pow10 << shift;
+            break;
+        }
+        pow10 /= 10;
+    }
+
+    // Round the last digit towards w
+    while (rest < dist && delta - rest >= unit &&
+           (rest + unit < dist || dist - rest > rest + unit - dist)) {
+        digits[length - 1]--;
+        rest += unit;
+    }
+    return length;
+}
+
+// --- Commodore layout ---
+
+// Digits of an integer below 1e15, without the sign
+static int integerDigits(uint64_t value, char *digits) {
+    char reversed[20];
+    int length = 0;
+    do {
+        reversed[length++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    for (int i = 0; i < length; i++) {
+        digits[i] = reversed[length - 1 - i];
+    }
+    return length;
+}
+
+// Format a number as PRINT shows it, e.g. " 42 ", "-1.5 ", " .25 ", " 1E+20 ".
+// buffer must hold NUMBER_BUFFER_SIZE bytes; returns the length (not terminated).
+int formatNumber(double value, char *buffer) {
+    int pos = 0;
+    buffer[pos++] = signbit(value) && value != 0 ? '-' : ' ';
+    double magnitude = fabs(value);
+
+    if (isnan(value) || isinf(value)) {
+        memcpy(buffer + pos, isnan(value) ? "NAN " : "INF ", 4);
+        return pos + 4;
+    }
+
+    // Integer fast path: exact integers need no floating-point digit search
+    if (magnitude < 1e15 && magnitude == floor(magnitude)) {
+        pos += integerDigits((uint64_t)magnitude, buffer + pos);
+        buffer[pos++] = ' ';
+        return pos;
+    }
+
+    char digits[20];
+    int exponent;
+    int length = grisu2(magnitude, digits, &exponent);
+    int point = length + exponent; // value = 0.digits * 10^point
+
+    if (point - 1 >= -2 && point - 1 < 16) {
+        // Positional down to .01, as on the Commodore
+        if (point <= 0) {
+            buffer[pos++] = '.';
+            for (int i = point; i < 0; i++) {
+                buffer[pos++] = '0';
+            }
+            memcpy(buffer + pos, digits, length);
+            pos += length;
+        } else if (point < length) {
+            memcpy(buffer + pos, digits, point);
+            pos += point;
+            buffer[pos++] = '.';
+            memcpy(buffer + pos, digits + point, length - point);
+            pos += length - point;
+        } else {
+            memcpy(buffer + pos, digits, length);
+            pos += length;
+            for (int i = length; i < point; i++) {
+                buffer[pos++] = '0';
+            }
+        }
+    } else {
+        // Scientific: 1.5E+20, 2E-05
+        buffer[pos++] = digits[0];
+        if (length > 1) {
+            buffer[pos++] = '.';
+            memcpy(buffer + pos, digits + 1, length - 1);
+            pos += length - 1;
+        }
+        int e = point - 1;
+        buffer[pos++] = 'E';
+        buffer[pos++] = e < 0 ? '-' : '+';
+        e = abs(e);
+        if (e >= 100) {
+            buffer[pos++] = (char)('0' + e / 100);
+        }
+        buffer[pos++] = (char)('0' + e / 10 % 10);
+        buffer[pos++] = (char)('0' + e % 10);
+    }
+    buffer[pos++] = ' ';
+    return pos;
+}
+
+// --- PRINT USING ---
+
+typedef enum {
+    FIELD_NUMBER, // ##,###.## with optional leading + or trailing -
+    FIELD_STRING, // & (whole string)
+    FIELD_FIRST   // ! (first character)
+} FieldType;
+
+typedef struct {
+    FieldType type;
+    int prefixStart, prefixLength; // Literal text before the field
+    int intDigits; // Positions before the point (including any + sign slot)
+    int fracDigits; // Positions after the point, -1 for no point
+    bool comma; // Group thousands
+    bool plus; // Leading + shows the sign either way
+    bool trailingMinus; // Trailing - shows a minus sign after the number
+} UsingField;
+
+typedef struct UsingFormat {
+    char *source; // Copy of the format string it was compiled from
+    int numFields;
+    int trailerStart; // Literal text after the last field
+    UsingField fields[];
+} UsingFormat;
+
+// Compile a PRINT USING format string into fields and literal spans
+static UsingFormat *compileUsing(const char *source) {
+    int capacity = 1;
+    for (const char *c = source; *c; c++) {
+        capacity += *c == '#' || *c == '&' || *c == '!';
+    }
+    UsingFormat *format = malloc(sizeof(UsingFormat) + capacity * sizeof(UsingField));
+    if (!format) {
+        perror("malloc");
+        return NULL;
+    }
+    format->source = strdup(source);
+    if (!format->source) {
+        perror("strdup");
+        free(format);
+        return NULL;
+    }
+    format->numFields = 0;
+
+    int literalStart = 0;
+    int i = 0;
+    while (source[i]) {
+        int start = i;
+        UsingField field;
+        memset(&field, 0, sizeof(field));
+        field.fracDigits = -1;
+        if (source[i] == '&' || source[i] == '!') {
+            field.type = source[i] == '&' ? FIELD_STRING : FIELD_FIRST;
+            i++;
+        } else if (source[i] == '#' || (source[i] == '+' && (source[i + 1] == '#' || source[i + 1] == '.')) ||
+                   (source[i] == '.' && source[i + 1] == '#')) {
+            field.type = FIELD_NUMBER;
+            if (source[i] == '+') {
+                field.plus = true;
+                field.intDigits++;
+                i++;
+            }
+            while (source[i] == '#' || (source[i] == ',' && field.intDigits > 0 && source[i + 1] == '#')) {
+                if (source[i] == ',') {
+                    field.comma = true;
+                }
+                field.intDigits++;
+                i++;
+            }
+            if (source[i] == '.') {
+                field.fracDigits = 0;
+                i++;
+                while (source[i] == '#') {
+                    field.fracDigits++;
+                    i++;
+                }
+            }
+            if (source[i] == '-' && !field.plus) {
+                field.trailingMinus = true;
+                i++;
+            }
+        } else {
+            i++;
+            continue;
+        }
+        field.prefixStart = literalStart;
+        field.prefixLength = start - literalStart;
+        format->fields[format->numFields++] = field;
+        literalStart = i;
+    }
+    format->trailerStart = literalStart;
+    return format;
+}
+
+// Release a compiled format
+void freeUsingFormat(UsingFormat *format) {
+    if (format) {
+        free(format->source);
+        free(format);
+    }
+}
+
+// Compiled format for a format string, reusing the one cached on the USING
+// token while the string stays the same (always, for a literal)
+UsingFormat *usingFormat(Token *usingToken, const char *source, int length) {
+    UsingFormat *format = usingToken->format;
+    if (format && strncmp(format->source, source, length) == 0 && format->source[length] == '\0') {
+        return format;
+    }
+    freeUsingFormat(format);
+    char *text = strndup(source, length);
+    if (!text) {
+        perror("strndup");
+        exit(1);
+    }
+    usingToken->format = compileUsing(text);
+    free(text);
+    return usingToken->format;
+}
+
+// Number of fields a format has (0: it has no field to print values with)
+int usingFieldCount(UsingFormat *format) {
+    return format->numFields;
+}
+
+// Print a number into a numeric field, or the field width of * if it does not fit
+static void printNumberField(UsingField *field, double value) {
+    int width = field->intDigits + (field->fracDigits >= 0 ? field->fracDigits + 1 : 0) + field->trailingMinus;
+    bool negative = value < 0;
+    double magnitude = fabs(value);
+    int frac = field->fracDigits > 0 ? field->fracDigits : 0;
+    double scaled = floor(magnitude * pow(10, frac) + 0.5);
+
+    // Room for the fraction, the point, up to 18 integer digits with their
+    // commas and a sign; a field with a long fraction needs a bigger buffer
+    char buffer[64];
+    int size = frac + 32;
+    char *text = buffer;
+    if (size > (int)sizeof(buffer)) {
+        text = malloc(size);
+        if (!text) {
+            perror("malloc");
+            return;
+        }
+    }
+    int pos = size;
+    if (scaled < 1e18) {
+        uint64_t units = (uint64_t)scaled;
+        for (int d = 0; d < frac; d++) {
+            text[--pos] = (char)('0' + units % 10);
+            units /= 10;
+        }
+        if (field->fracDigits >= 0) {
+            text[--pos] = '.';
+        }
+        int group = 0;
+        do {
+            if (field->comma && group == 3) {
+                text[--pos] = ',';
+                group = 0;
+            }
+            text[--pos] = (char)('0' + units % 10);
+            units /= 10;
+            group++;
+        } while (units > 0);
+        if (field->plus) {
+            text[--pos] = negative ? '-' : '+';
+        } else if (negative && !field->trailingMinus) {
+            text[--pos] = '-';
+        }
+    }
+
+    int length = size - pos;
+    int trailer = field->trailingMinus ? 1 : 0;
+    if (scaled >= 1e18 || length + trailer > width) {
+        for (int i = 0; i < width; i++) {
+            outPutc('*');
+        }
+    } else {
+        for (int i = length + trailer; i < width; i++) {
+            outPutc(' ');
+        }
+        outWrite(text + pos, length);
+        if (field->trailingMinus) {
+            outPutc(negative ? '-' : ' ');
+        }
+    }
+    if (text != buffer) {
+        free(text);
+    }
+}
+
+// Print one value with the next field of a format; returns the field after it
+int printUsingValue(UsingFormat *format, int fieldIndex, Value *value) {
+    if (fieldIndex >= format->numFields) {
+        fieldIndex = 0; // More values than fields: start the format again
+    }
+    UsingField *field = &format->fields[fieldIndex];
+    outWrite(format->source + field->prefixStart, field->prefixLength);
+
+    if (field->type == FIELD_NUMBER) {
+        if (value->type != VAR_TYPE_NUMERIC) {
+            outPrintf("Type mismatch\n");
+        } else {
+            printNumberField(field, value->num);
+        }
+    } else if (value->type != VAR_TYPE_STRING) {
+        outPrintf("Type mismatch\n");
+    } else if (field->type == FIELD_STRING) {
+        outWrite(stringChars(&value->str), value->str.length);
+    } else if (value->str.length > 0) {
+        outPutc(stringChars(&value->str)[0]);
+    }
+    return fieldIndex + 1;
+}
+
+// Print the literal text that follows the last value printed
+void printUsingEnd(UsingFormat *format, int fieldIndex) {
+    if (fieldIndex < format->numFields) {
+        UsingField *field = &format->fields[fieldIndex];
+        outWrite(format->source + field->prefixStart, field->prefixLength);
+    } else {
+        outWrite(format->source + format->trailerStart, strlen(format->source + format->trailerStart));
+    }
+}
@@ -0,0 +1,400 @@
+#include "cbsh.h"
+
+// Binary program images, the tokenized form of a program (like a Commodore
+// PRG file). An image holds each distinct token string once, every line's
+// tokens with their numbers already parsed, the statement tables and the
+// line index each number token resolves to as a jump target, so loading one
+// is a validation pass and some copying, with no lexing at all.
+//
+// Layout (native byte order, each section starting 8-byte aligned):
+//   ImageHeader
+//   uint32_t stringOffsets[numStrings], then the NUL-terminated strings
+//   ImageLine lines[numLines]
+//   int32_t statements[numStatements] (each line's table, numStatements + 1 entries per line)
+//   ImageToken tokens[numTokens]
+//   ImageNumber numbers[numNumbers] (one per number token, in token order)
+
+#define IMAGE_MAGIC "CBSHIMG\n"
+#define IMAGE_FORMAT 3 // Bump when token or keyword numbering changes
+#define IMAGE_BYTE_ORDER 0x01020304u
+
+typedef struct {
+    char magic[8];
+    uint32_t format; // IMAGE_FORMAT
+    uint32_t byteOrder; // IMAGE_BYTE_ORDER as written by the saving machine
+    char version[16]; // PACKAGE_VERSION of the cbsh that wrote it
+    uint64_t sourceHash; // Hash of the script it was built from, 0 for SAVE
+    uint32_t numStrings;
+    uint32_t stringBytes;
+    uint32_t numLines;
+    uint32_t numStatements;
+    uint32_t numTokens;
+    uint32_t numNumbers;
+} ImageHeader;
+
+typedef struct {
+    int32_t lineNumber;
+    int32_t numTokens;
+    int32_t numStatements;
+} ImageLine;
+
+typedef struct {
+    uint8_t type;
+    uint8_t keyword;
+    uint16_t reserved;
+    uint32_t string; // Index into the string table
+} ImageToken;
+
+typedef struct {
+    double value;
+    int32_t target; // Line index the number names, or -1
+    int32_t reserved;
+} ImageNumber;
+
+// Section offsets for the counts in a header
+typedef struct {
+    size_t strings; // stringOffsets[]
+    size_t stringData;
+    size_t lines;
+    size_t statements;
+    size_t tokens;
+    size_t numbers;
+    size_t size; // Total image size
+} ImageLayout;
+
+static size_t align8(size_t offset) {
+    return (offset + 7) & ~(size_t)7;
+}
+
+static ImageLayout imageLayout(const ImageHeader *header) {
+    ImageLayout layout;
+    layout.strings = align8(sizeof(ImageHeader));
+    layout.stringData = layout.strings + (size_t)header->numStrings * sizeof(uint32_t);
+    layout.lines = align8(layout.stringData + header->stringBytes);
+    layout.statements = align8(layout.lines + (size_t)header->numLines * sizeof(ImageLine));
+    layout.tokens = align8(layout.statements + (size_t)header->numStatements * sizeof(int32_t));
+    layout.numbers = align8(layout.tokens + (size_t)header->numTokens * sizeof(ImageToken));
+    layout.size = layout.numbers + (size_t)header->numNumbers * sizeof(ImageNumber);
+    return layout;
+}
+
+// 64-bit FNV-1a hash of a script's text, the key of its cached image
+uint64_t hashSource(const char *text, size_t len) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 1099511628211ull;
+    }
+    return hash ? hash : 1; // 0 is reserved for SAVEd images
+}
+
+// Whether a file's contents start like an image
+bool isImage(const char *data, size_t size) {
+    return size >= sizeof(ImageHeader) && memcmp(data, IMAGE_MAGIC, 8) == 0;
+}
+
+// --- Saving ---
+
+// String table under construction: interned pointers map to their index
+typedef struct {
+    const char **keys;
+    int *indexes;
+    int capacity; // Power of two
+    const char **strings; // In index order
+    int numStrings;
+    size_t bytes;
+} StringTable;
+
+// Index of a token string in the table, adding it if new
+static int stringIndex(StringTable *table, const char *str) {
+    int mask = table->capacity - 1;
+    int pos = (int)(((uintptr_t)str >> 3) * 2654435761u) & mask;
+    while (table->keys[pos] && table->keys[pos] != str) {
+        pos = (pos + 1) & mask;
+    }
+    if (!table->keys[pos]) {
+        table->keys[pos] = str;
+        table->indexes[pos] = table->numStrings;
+        table->strings[table->numStrings++] = str;
+        table->bytes += strlen(str) + 1;
+    }
+    return table->indexes[pos];
+}
+
+// Write the current program as an image. Reports errors only if asked to
+// (caching is silent: an unwritable directory just means no cache).
+bool saveImage(const char *path, uint64_t sourceHash, bool report) {
+    ImageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IMAGE_MAGIC, 8);
+    header.format = IMAGE_FORMAT;
+    header.byteOrder = IMAGE_BYTE_ORDER;
+    strncpy(header.version, PACKAGE_VERSION, sizeof(header.version) - 1);
+    header.sourceHash = sourceHash;
+    header.numLines = numLines;
+    for (int i = 0; i < numLines; i++) {
+        header.numTokens += program[i]->numTokens;
+        header.numStatements += program[i]->numStatements + 1;
+        for (int t = 0; t < program[i]->numTokens; t++) {
+            header.numNumbers += program[i]->tokens[t].type == TOKEN_NUMBER;
+        }
+    }
+
+    // Distinct strings: at most one per token
+    StringTable table;
+    table.capacity = 16;
+    while (table.capacity < 2 * (int)header.numTokens + 2) {
+        table.capacity *= 2;
+    }
+    table.keys = calloc(table.capacity, sizeof(const char *));
+    table.indexes = malloc(table.capacity * sizeof(int));
+    table.strings = malloc((header.numTokens + 1) * sizeof(const char *));
+    table.numStrings = 0;
+    table.bytes = 0;
+    if (!table.keys || !table.indexes || !table.strings) {
+        perror("malloc");
+        exit(1);
+    }
+    for (int i = 0; i < numLines; i++) {
+        for (int t = 0; t < program[i]->numTokens; t++) {
+            stringIndex(&table, program[i]->tokens[t].value);
+        }
+    }
+    header.numStrings = table.numStrings;
+    header.stringBytes = table.bytes;
+
+    ImageLayout layout = imageLayout(&header);
+    char *image = calloc(1, layout.size);
+    if (!image) {
+        perror("calloc");
+        exit(1);
+    }
+    memcpy(image, &header, sizeof(header));
+
+    uint32_t *offsets = (uint32_t *)(image + layout.strings);
+    size_t used = 0;
+    for (int s = 0; s < table.numStrings; s++) {
+        size_t len = strlen(table.strings[s]) + 1;
+        offsets[s] = used;
+        memcpy(image + layout.stringData + used, table.strings[s], len);
+        used += len;
+    }
+
+    ImageLine *lines = (ImageLine *)(image + layout.lines);
+    int32_t *statements = (int32_t *)(image + layout.statements);
+    ImageToken *tokens = (ImageToken *)(image + layout.tokens);
+    ImageNumber *numbers = (ImageNumber *)(image + layout.numbers);
+    for (int i = 0; i < numLines; i++) {
+        Line *line = program[i];
+        lines[i].lineNumber = line->lineNumber;
+        lines[i].numTokens = line->numTokens;
+        lines[i].numStatements = line->numStatements;
+        for (int s = 0; s <= line->numStatements; s++) {
+            *statements++ = line->statements[s];
+        }
+        for (int t = 0; t < line->numTokens; t++) {
+            Token *token = &line->tokens[t];
+            tokens->type = token->type;
+            tokens->keyword = token->keyword;
+            tokens->string = stringIndex(&table, token->value);
+            tokens++;
+            if (token->type == TOKEN_NUMBER) {
+                numbers->value = token->number;
+                numbers->target = token->isInteger ? findLineIndex(token->integer) : -1;
+                numbers++;
+            }
+        }
+    }
+    free(table.keys);
+    free(table.indexes);
+    free(table.strings);
+
+    // Write a temporary file and rename it, so readers never see half an image
+    size_t tempSize = strlen(path) + 32;
+    char *tempPath = malloc(tempSize);
+    if (!tempPath) {
+        perror("malloc");
+        exit(1);
+    }
+    snprintf(tempPath, tempSize, "%s.%ld.tmp", path, (long)getpid());
+    bool ok = false;
+    int fd = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        size_t written = 0;
+        while (written < layout.size) {
+            ssize_t n = write(fd, image + written, layout.size - written);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            written += n;
+        }
+        ok = close(fd) == 0 && written == layout.size && rename(tempPath, path) == 0;
+        if (!ok) {
+            unlink(tempPath);
+        }
+    }
+    if (!ok && report) {
+        outPrintf("Cannot write %s: %s\n", path, strerror(errno));
+    }
+    free(tempPath);
+    free(image);
+    return ok;
+}
+
+// --- Loading ---
+
+// Check that an image is complete and consistent before anything is built from it
+static bool validImage(const char *data, size_t size, const ImageHeader *header) {
+    if (header->format != IMAGE_FORMAT || header->byteOrder != IMAGE_BYTE_ORDER ||
+        strncmp(header->version, PACKAGE_VERSION, sizeof(header->version)) != 0) {
+        return false;
+    }
+    ImageLayout layout = imageLayout(header);
+    if (layout.size != size) {
+        return false;
+    }
+
+    const uint32_t *offsets = (const uint32_t *)(data + layout.strings);
+    const char *stringData = data + layout.stringData;
+    if (header->stringBytes > 0 && stringData[header->stringBytes - 1] != '\0') {
+        return false;
+    }
+    for (uint32_t s = 0; s < header->numStrings; s++) {
+        // Each string must end inside the blob, so strlen stays within it
+        if (offsets[s] >= header->stringBytes ||
+            !memchr(stringData + offsets[s], '\0', header->stringBytes - offsets[s])) {
+            return false;
+        }
+    }
+
+    const ImageLine *lines = (const ImageLine *)(data + layout.lines);
+    const int32_t *statements = (const int32_t *)(data + layout.statements);
+    const ImageToken *tokens = (const ImageToken *)(data + layout.tokens);
+    uint64_t totalTokens = 0, totalStatements = 0;
+    for (uint32_t i = 0; i < header->numLines; i++) {
+        const ImageLine *line = &lines[i];
+        if (line->lineNumber <= 0 || (i > 0 && line->lineNumber <= lines[i - 1].lineNumber) ||
+            line->numTokens <= 0 || line->numStatements <= 0 ||
+            totalTokens + line->numTokens > header->numTokens ||
+            totalStatements + line->numStatements + 1 > header->numStatements) {
+            return false;
+        }
+        const int32_t *table = statements + totalStatements;
+        if (table[0] != 0 || table[line->numStatements] != line->numTokens + 1) {
+            return false;
+        }
+        // Statement s spans table[s] .. table[s + 1] - 2, so offsets must rise
+        // strictly (an empty statement has length 0, never -1)
+        for (int s = 1; s <= line->numStatements; s++) {
+            if (table[s] <= table[s - 1] || table[s] > line->numTokens + 1) {
+                return false;
+            }
+        }
+        totalTokens += line->numTokens;
+        totalStatements += line->numStatements + 1;
+    }
+    if (totalTokens != header->numTokens || totalStatements != header->numStatements) {
+        return false;
+    }
+
+    const ImageNumber *numbers = (const ImageNumber *)(data + layout.numbers);
+    uint32_t numNumbers = 0;
+    for (uint32_t t = 0; t < header->numTokens; t++) {
+        if (tokens[t].type > TOKEN_COLON || tokens[t].keyword >= KW_COUNT || tokens[t].string >= header->numStrings) {
+            return false;
+        }
+        if (tokens[t].type == TOKEN_NUMBER) {
+            if (numNumbers == header->numNumbers) {
+                return false;
+            }
+            int32_t target = numbers[numNumbers++].target;
+            if (target < -1 || target >= (int32_t)header->numLines) {
+                return false;
+            }
+        }
+    }
+    return numNumbers == header->numNumbers;
+}
+
+// Load an image into an empty program. With checkHash, only an image built
+// from a script with the given hash is accepted. Returns false, leaving the
+// program untouched, if the image is unusable.
+bool loadImage(const char *data, size_t size, bool checkHash, uint64_t sourceHash) {
+    if (!isImage(data, size) || numLines != 0) {
+        return false;
+    }
+    ImageHeader header;
+    memcpy(&header, data, sizeof(header));
+    if ((checkHash && header.sourceHash != sourceHash) || !validImage(data, size, &header)) {
+        return false;
+    }
+
+    ImageLayout layout = imageLayout(&header);
+    const uint32_t *offsets = (const uint32_t *)(data + layout.strings);
+    const ImageLine *lines = (const ImageLine *)(data + layout.lines);
+    const int32_t *statements = (const int32_t *)(data + layout.statements);
+    const ImageToken *tokens = (const ImageToken *)(data + layout.tokens);
+    const ImageNumber *numbers = (const ImageNumber *)(data + layout.numbers);
+
+    // Each distinct string is interned once, however many tokens use it
+    const char **strings = malloc((header.numStrings + 1) * sizeof(const char *));
+    if (!strings) {
+        perror("malloc");
+        exit(1);
+    }
+    for (uint32_t s = 0; s < header.numStrings; s++) {
+        const char *str = data + layout.stringData + offsets[s];
+        strings[s] = internString(str, strlen(str));
+    }
+
+    for (uint32_t i = 0; i < header.numLines; i++) {
+        Line line;
+        line.lineNumber = lines[i].lineNumber;
+        line.numTokens = lines[i].numTokens;
+        line.numStatements = lines[i].numStatements;
+        line.tokens = malloc(line.numTokens * sizeof(Token));
+        line.statements = malloc((line.numStatements + 1) * sizeof(int));
+        if (!line.tokens || !line.statements) {
+            perror("malloc");
+            exit(1);
+        }
+        for (int s = 0; s <= line.numStatements; s++) {
+            line.statements[s] = *statements++;
+        }
+        for (int t = 0; t < line.numTokens; t++, tokens++) {
+            Token *token = &line.tokens[t];
+            token->type = tokens->type;
+            token->keyword = tokens->keyword;
+            token->value = strings[tokens->string];
+            token->target = -1;
+            token->targetGeneration = 0;
+            token->slot = -1;
+            token->expr = NULL;
+            token->format = NULL;
+            token->number = 0;
+            token->integer = 0;
+            token->isInteger = false;
+            if (token->type == TOKEN_NUMBER) {
+                setTokenNumber(token, numbers->value);
+                token->target = numbers->target;
+                numbers++;
+            }
+        }
+        appendLine(&line);
+    }
+    free(strings);
+    finishAppend();
+
+    // The saved jump targets are line indices of exactly this program
+    for (int i = 0; i < numLines; i++) {
+        for (int t = 0; t < program[i]->numTokens; t++) {
+            if (program[i]->tokens[t].type == TOKEN_NUMBER) {
+                program[i]->tokens[t].targetGeneration = programGeneration;
+            }
+        }
+    }
+    return true;
+}
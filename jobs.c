@@ -0,0 +1,188 @@
+#include "cbsh.h"
+
+// Commands started by LOAD. They are launched with posix_spawnp, which does
+// not copy the interpreter's address space the way fork() does, so starting
+// a command costs the same however large the program and its arrays are.
+// LOAD waits for its own child by PID and leaves the exit status in ST.
+// LOAD ending in & starts the command as a background job instead:
+//
+//   JOBS      list the jobs and whether they are still running
+//   WAIT [N]  wait for job N (or every job), leaving its exit status in ST
+//
+// Finished jobs are reaped (so they do not linger as zombies) before each
+// prompt and each LOAD; a job keeps its number and exit status until WAIT
+// collects it.
+
+extern char **environ;
+
+#define MAX_JOBS 64
+
+typedef struct {
+    pid_t pid; // 0 for a free entry
+    char *command;
+    bool done;
+    int status; // Exit status, once done
+} Job;
+
+static Job jobs[MAX_JOBS];
+static int runningJobs = 0; // Jobs not yet reaped, so reapJobs is free when there are none
+
+// Exit status of a child as a shell reports it: its exit code, or 128 plus
+// the signal that killed it
+static int exitStatus(int status) {
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return WEXITSTATUS(status);
+}
+
+// Leave a command's exit status where the program can read it
+static void setStatus(int status) {
+    addOrUpdateVariable("ST", VAR_TYPE_NUMERIC, status, NULL);
+}
+
+// Wait for one child, returning its exit status or -1
+static int waitForChild(pid_t pid) {
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            perror("waitpid");
+            return -1;
+        }
+    }
+    return exitStatus(status);
+}
+
+// Reap the jobs that have finished since we last looked, without blocking,
+// keeping their exit status for WAIT
+void reapJobs() {
+    for (int i = 0; i < MAX_JOBS && runningJobs > 0; i++) {
+        int status;
+        if (jobs[i].pid && !jobs[i].done && waitpid(jobs[i].pid, &status, WNOHANG) == jobs[i].pid) {
+            jobs[i].done = true;
+            jobs[i].status = exitStatus(status);
+            runningJobs--;
+        }
+    }
+}
+
+// The command line of a job, for JOBS
+static char *commandText(char *const argv[]) {
+    size_t length = 1;
+    for (int i = 0; argv[i]; i++) {
+        length += strlen(argv[i]) + 1;
+    }
+    char *text = malloc(length);
+    if (!text) {
+        perror("malloc");
+        return NULL;
+    }
+    text[0] = '\0';
+    for (int i = 0; argv[i]; i++) {
+        if (i > 0) {
+            strcat(text, " ");
+        }
+        strcat(text, argv[i]);
+    }
+    return text;
+}
+
+// Run a command, waiting for it unless it goes in the background
+void runCommand(char *const argv[], bool background) {
+    reapJobs();
+    if (!argv[0]) {
+        outPrintf("Invalid LOAD statement: no command to run\n");
+        setStatus(127);
+        return;
+    }
+    int job = -1;
+    if (background) {
+        for (int i = 0; i < MAX_JOBS; i++) {
+            if (!jobs[i].pid) {
+                job = i;
+                break;
+            }
+        }
+        if (job < 0) {
+            outPrintf("Too many jobs, WAIT for some first\n");
+            return;
+        }
+    }
+
+    outFlush(); // The child writes to the same terminal
+    pid_t pid;
+    int error = posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ);
+    if (error != 0) {
+        outPrintf("Cannot run %s: %s\n", argv[0], strerror(error));
+        setStatus(127);
+        return;
+    }
+
+    if (!background) {
+        setStatus(waitForChild(pid));
+        return;
+    }
+    jobs[job].pid = pid;
+    jobs[job].command = commandText(argv);
+    jobs[job].done = false;
+    runningJobs++;
+    setStatus(0);
+    outPrintf("[%d] %d\n", job + 1, (int)pid);
+}
+
+// Wait for a job and free its entry, returning its exit status
+static int collectJob(int job) {
+    int status = jobs[job].status;
+    if (!jobs[job].done) {
+        status = waitForChild(jobs[job].pid);
+        runningJobs--;
+    }
+    free(jobs[job].command);
+    jobs[job].command = NULL;
+    jobs[job].pid = 0;
+    return status;
+}
+
+// Execute JOBS command
+void executeJobs() {
+    reapJobs();
+    for (int i = 0; i < MAX_JOBS; i++) {
+        if (!jobs[i].pid) {
+            continue;
+        }
+        char state[16];
+        if (!jobs[i].done) {
+            strcpy(state, "Running");
+        } else if (jobs[i].status == 0) {
+            strcpy(state, "Done");
+        } else {
+            snprintf(state, sizeof(state), "Exit %d", jobs[i].status);
+        }
+        outPrintf("[%d] %-8d %-10s %s\n", i + 1, (int)jobs[i].pid, state, jobs[i].command ? jobs[i].command : "");
+    }
+}
+
+// Execute WAIT command: WAIT waits for every job, WAIT N for job N
+void executeWait(Token *tokens, int numTokens) {
+    if (numTokens > 1) {
+        double number = evaluateExpression(tokens + 1, numTokens - 1);
+        if (!isfinite(number) || number < 1 || number >= MAX_JOBS + 1) {
+            outPrintf("Illegal quantity in WAIT: %g\n", number);
+            return;
+        }
+        int job = (int)number - 1;
+        if (!jobs[job].pid) {
+            outPrintf("No such job: %d\n", job + 1);
+            return;
+        }
+        setStatus(collectJob(job));
+        return;
+    }
+    int status = 0;
+    for (int i = 0; i < MAX_JOBS; i++) {
+        if (jobs[i].pid) {
+            status = collectJob(i);
+        }
+    }
+    setStatus(status);
+}
@@ -1,11 +1,202 @@
 #include "cbsh.h"
 
+// Keyword registry. Adding a keyword only needs an entry here: lookups go
+// through a perfect hash built from this table, so their cost does not grow.
+static const struct {
+    const char *name;
+    Keyword keyword;
+} keywordTable[] = {
+    {"LIST", KW_LIST}, {"NEW", KW_NEW}, {"PRINT", KW_PRINT}, {"INPUT", KW_INPUT},
+    {"LOAD", KW_LOAD}, {"DIR", KW_DIR}, {"IF", KW_IF}, {"THEN", KW_THEN},
+    {"FOR", KW_FOR}, {"NEXT", KW_NEXT}, {"SQR", KW_SQR}, {"RND", KW_RND},
+    {"SIN", KW_SIN}, {"LET", KW_LET}, {"USR", KW_USR}, {"DATA", KW_DATA},
+    {"READ", KW_READ}, {"REM", KW_REM}, {"CLEAR", KW_CLEAR}, {"STOP", KW_STOP},
+    {"TAB", KW_TAB}, {"RESTORE", KW_RESTORE}, {"ABS", KW_ABS}, {"END", KW_END},
+    {"INT", KW_INT}, {"RETURN", KW_RETURN}, {"STEP", KW_STEP}, {"GOTO", KW_GOTO},
+    {"GOSUB", KW_GOSUB}, {"SET", KW_SET}, {"TO", KW_TO}, {"RUN", KW_RUN},
+    {"ADD", KW_ADD}, {"DIV", KW_DIV}, {"FLOOR", KW_FLOOR}, {"SUB", KW_SUB},
+    {"AND", KW_AND}, {"OR", KW_OR}, {"NOT", KW_NOT}, {"ON", KW_ON},
+    {"USING", KW_USING}, {"SAVE", KW_SAVE}, {"DIM", KW_DIM},
+    {"MAT", KW_MAT}, {"SUM", KW_SUM}, {"DOT", KW_DOT},
+    {"LEN", KW_LEN}, {"LEFT$", KW_LEFT}, {"RIGHT$", KW_RIGHT}, {"MID$", KW_MID},
+    {"INSTR", KW_INSTR}, {"COS", KW_COS}, {"ATN", KW_ATN}, {"EXP", KW_EXP},
+    {"LOG", KW_LOG}, {"SGN", KW_SGN}, {"STATS", KW_STATS},
+    {"JOBS", KW_JOBS}, {"WAIT", KW_WAIT},
+};
+
+#define NUM_KEYWORDS (int)(sizeof(keywordTable) / sizeof(keywordTable[0]))
+
+// Perfect hash: keywordSlots[hash & keywordMask] holds the only keyword that
+// can match, or -1. The seed is searched once so that no two keywords collide.
+static int *keywordSlots = NULL;
+static unsigned int keywordMask = 0;
+static unsigned int keywordSeed = 0;
+static size_t keywordMaxLength = 0;
+
+// Case-insensitive hash of a word under the current seed
+static unsigned int keywordHash(const char *text, size_t len, unsigned int seed) {
+    unsigned int hash = seed;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)toupper((unsigned char)text[i])) * 16777619u;
+    }
+    return hash ^ (hash >> 15);
+}
+
+// Find a seed and table size that give every keyword its own slot
+static void buildKeywordHash() {
+    for (unsigned int size = 64; ; size *= 2) {
+        int *slots = malloc(size * sizeof(int));
+        if (!slots) {
+            perror("malloc");
+            exit(1);
+        }
+        for (unsigned int seed = 2166136261u; seed < 2166136261u + 4096; seed++) {
+            bool collision = false;
+            for (unsigned int i = 0; i < size; i++) {
+                slots[i] = -1;
+            }
+            for (int k = 0; k < NUM_KEYWORDS && !collision; k++) {
+                size_t len = strlen(keywordTable[k].name);
+                unsigned int slot = keywordHash(keywordTable[k].name, len, seed) & (size - 1);
+                if (slots[slot] != -1) {
+                    collision = true;
+                }
+                slots[slot] = k;
+                if (len > keywordMaxLength) {
+                    keywordMaxLength = len;
+                }
+            }
+            if (!collision) {
+                keywordSlots = slots;
+                keywordMask = size - 1;
+                keywordSeed = seed;
+                return;
+            }
+        }
+        free(slots);
+    }
+}
+
+// Classify a word as a keyword in O(1), or return KW_NONE
+Keyword lookupKeyword(const char *text, size_t len) {
+    if (!keywordSlots) {
+        buildKeywordHash();
+    }
+    if (len > keywordMaxLength) {
+        return KW_NONE;
+    }
+    int k = keywordSlots[keywordHash(text, len, keywordSeed) & keywordMask];
+    if (k == -1 || strncasecmp(keywordTable[k].name, text, len) != 0 || keywordTable[k].name[len] != '\0') {
+        return KW_NONE;
+    }
+    return keywordTable[k].keyword;
+}
+
+// Length of a hex literal (0x1F or &H1F) at text, or 0 if there is none
+static int hexLiteralLength(const char *text) {
+    int prefix = 0;
+    if (text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) {
+        prefix = 2;
+    } else if (text[0] == '&' && (text[1] == 'h' || text[1] == 'H')) {
+        prefix = 2;
+    }
+    if (prefix == 0 || !isxdigit((unsigned char)text[prefix])) {
+        return 0;
+    }
+    int len = prefix;
+    while (isxdigit((unsigned char)text[len])) {
+        len++;
+    }
+    return len;
+}
+
+// Length of a decimal literal at text (12, 1.5, .5, 1E6, 2.5e-3), or 0
+static int decimalLiteralLength(const char *text) {
+    int len = 0;
+    int digits = 0;
+    while (isdigit((unsigned char)text[len])) {
+        len++;
+        digits++;
+    }
+    if (text[len] == '.') {
+        len++;
+        while (isdigit((unsigned char)text[len])) {
+            len++;
+            digits++;
+        }
+    }
+    if (digits == 0) {
+        return 0;
+    }
+    // An exponent only counts if digits follow, so "1E" stays 1 then E
+    if (text[len] == 'e' || text[len] == 'E') {
+        int exp = len + 1;
+        if (text[exp] == '+' || text[exp] == '-') {
+            exp++;
+        }
+        if (isdigit((unsigned char)text[exp])) {
+            len = exp;
+            while (isdigit((unsigned char)text[len])) {
+                len++;
+            }
+        }
+    }
+    return len;
+}
+
+// Store a number token's value, with its int form when it has an exact one
+void setTokenNumber(Token *token, double number) {
+    token->number = number;
+    token->isInteger = number == floor(number) && fabs(number) <= INT_MAX;
+    token->integer = token->isInteger ? (int)number : 0;
+}
+
+// Parse a numeric literal once, storing its value (and int form) in the token.
+// Returns false, after reporting it, for a value too large to hold.
+static bool parseNumber(Token *token, const char *text, int len, bool hex) {
+    char small[64];
+    char *buffer = small;
+    if (len >= (int)sizeof(small)) {
+        buffer = malloc(len + 1); // A long literal, such as .000...1, is still exact
+        if (!buffer) {
+            perror("malloc");
+            return false;
+        }
+    }
+    memcpy(buffer, text, len);
+    buffer[len] = '\0';
+    errno = 0;
+    double number = hex ? (double)strtoull(buffer + 2, NULL, 16) : strtod(buffer, NULL);
+    bool ok = !(errno == ERANGE && (hex || isinf(number))); // Underflow to 0 is fine
+    if (!ok) {
+        outPrintf("Number out of range: %s\n", buffer);
+    }
+    if (buffer != small) {
+        free(buffer);
+    }
+    setTokenNumber(token, number);
+    return ok;
+}
+
+// A token with nothing resolved or compiled yet
+static void initToken(Token *token) {
+    token->type = TOKEN_EOF; // Default
+    token->keyword = KW_NONE;
+    token->value = ""; // Initialize value
+    token->target = -1;
+    token->targetGeneration = 0; // Never matches programGeneration
+    token->slot = -1;
+    token->expr = NULL;
+    token->format = NULL;
+    token->number = 0;
+    token->integer = 0;
+    token->isInteger = false;
+}
+
 // Function to get the next token from a line of input
-Token getNextToken(char *line, int *pos) {
+Token getNextToken(const char *line, int *pos) {
     Token token;
-    token.type = TOKEN_EOF; // Default
-    token.keyword = KW_NONE;
-    token.value[0] = '\0'; // Initialize value
+    initToken(&token);
 
     // Skip whitespace
     while (line[*pos] == ' ' || line[*pos] == '\t') {
@@ -18,87 +209,50 @@ Token getNextToken(char *line, int *pos) {
         return token;
     }
 
-    // Handle comments (REM or ')
+    // Handle comments (REM or '): the comment, colons and all, is one token
     if (line[*pos] == '\'') {
-        token.type = TOKEN_KEYWORD;
-        token.keyword = KW_REM;
-        strcpy(token.value, "REM");
-        (*pos)++;
+        int start = *pos;
         while (line[*pos] != '\0' && line[*pos] != '\n' && line[*pos] != '\r') {
             (*pos)++;
         }
+        token.type = TOKEN_KEYWORD;
+        token.keyword = KW_REM;
+        token.value = internString(&line[start], *pos - start);
+        return token;
+    }
+
+    // Number (checked first so &H1F and .5 are not taken as operators)
+    int hexLen = hexLiteralLength(&line[*pos]);
+    int numLen = hexLen ? hexLen : decimalLiteralLength(&line[*pos]);
+    if (numLen > 0) {
+        bool ok = parseNumber(&token, &line[*pos], numLen, hexLen > 0);
+        token.value = internString(&line[*pos], numLen);
+        token.type = ok ? TOKEN_NUMBER : TOKEN_EOF;
+        *pos += numLen;
         return token;
     }
 
     if (isalpha(line[*pos])) {
         // Identifier or keyword
         int start = *pos;
-        while (isalnum(line[*pos]) || line[*pos] == '$') { // Handle string variables (e.g., A$)
+        while (isalnum(line[*pos]) || line[*pos] == '$' || line[*pos] == '%') { // Handle string (A$) and integer (A%) variables
             (*pos)++;
         }
-        int len = *pos - start;
-        if (len >= MAX_LINE_LENGTH) {
-            len = MAX_LINE_LENGTH - 1; // Prevent buffer overflow
-        }
-        strncpy(token.value, &line[start], len);
-        token.value[len] = '\0';
+        token.value = internString(&line[start], *pos - start);
         token.type = TOKEN_IDENTIFIER;
 
         // Check if it's a keyword
-        if (strcasecmp(token.value, "LIST") == 0) token.keyword = KW_LIST;
-        else if (strcasecmp(token.value, "NEW") == 0) token.keyword = KW_NEW;
-        else if (strcasecmp(token.value, "PRINT") == 0) token.keyword = KW_PRINT;
-        else if (strcasecmp(token.value, "INPUT") == 0) token.keyword = KW_INPUT;
-        else if (strcasecmp(token.value, "LOAD") == 0) token.keyword = KW_LOAD;
-        else if (strcasecmp(token.value, "DIR") == 0) token.keyword = KW_DIR;
-        else if (strcasecmp(token.value, "IF") == 0) token.keyword = KW_IF;
-        else if (strcasecmp(token.value, "THEN") == 0) token.keyword = KW_THEN;
-        else if (strcasecmp(token.value, "FOR") == 0) token.keyword = KW_FOR;
-        else if (strcasecmp(token.value, "NEXT") == 0) token.keyword = KW_NEXT;
-        else if (strcasecmp(token.value, "SQR") == 0) token.keyword = KW_SQR;
-        else if (strcasecmp(token.value, "RND") == 0) token.keyword = KW_RND;
-        else if (strcasecmp(token.value, "SIN") == 0) token.keyword = KW_SIN;
-        else if (strcasecmp(token.value, "LET") == 0) token.keyword = KW_LET;
-        else if (strcasecmp(token.value, "USR") == 0) token.keyword = KW_USR;
-        else if (strcasecmp(token.value, "DATA") == 0) token.keyword = KW_DATA;
-        else if (strcasecmp(token.value, "READ") == 0) token.keyword = KW_READ;
-        else if (strcasecmp(token.value, "REM") == 0) token.keyword = KW_REM;
-        else if (strcasecmp(token.value, "CLEAR") == 0) token.keyword = KW_CLEAR;
-        else if (strcasecmp(token.value, "STOP") == 0) token.keyword = KW_STOP;
-        else if (strcasecmp(token.value, "TAB") == 0) token.keyword = KW_TAB;
-        else if (strcasecmp(token.value, "RESTORE") == 0) token.keyword = KW_RESTORE;
-        else if (strcasecmp(token.value, "ABS") == 0) token.keyword = KW_ABS;
-        else if (strcasecmp(token.value, "END") == 0) token.keyword = KW_END;
-        else if (strcasecmp(token.value, "INT") == 0) token.keyword = KW_INT;
-        else if (strcasecmp(token.value, "RETURN") == 0) token.keyword = KW_RETURN;
-        else if (strcasecmp(token.value, "STEP") == 0) token.keyword = KW_STEP;
-        else if (strcasecmp(token.value, "GOTO") == 0) token.keyword = KW_GOTO;
-        else if (strcasecmp(token.value, "GOSUB") == 0) token.keyword = KW_GOSUB;
-        else if (strcasecmp(token.value, "SET") == 0) token.keyword = KW_SET;
-        else if (strcasecmp(token.value, "TO") == 0) token.keyword = KW_TO;
-        else if (strcasecmp(token.value, "RUN") == 0) token.keyword = KW_RUN;
-        else if (strcasecmp(token.value, "ADD") == 0) token.keyword = KW_ADD;
-        else if (strcasecmp(token.value, "DIV") == 0) token.keyword = KW_DIV;
-        else if (strcasecmp(token.value, "FLOOR") == 0) token.keyword = KW_FLOOR;
-        else if (strcasecmp(token.value, "SUB") == 0) token.keyword = KW_SUB;
+        token.keyword = lookupKeyword(token.value, *pos - start);
 
         if (token.keyword != KW_NONE) {
             token.type = TOKEN_KEYWORD;
         }
-        return token;
-    } else if (isdigit(line[*pos])) {
-        // Number
-        int start = *pos;
-        while (isdigit(line[*pos]) || line[*pos] == '.') {
-            (*pos)++;
-        }
-        int len = *pos - start;
-        if (len >= MAX_LINE_LENGTH) {
-            len = MAX_LINE_LENGTH - 1;
+        if (token.keyword == KW_REM) {
+            while (line[*pos] != '\0' && line[*pos] != '\n' && line[*pos] != '\r') {
+                (*pos)++;
+            }
+            token.value = internString(&line[start], *pos - start);
         }
-        strncpy(token.value, &line[start], len);
-        token.value[len] = '\0';
-        token.type = TOKEN_NUMBER;
         return token;
     } else if (line[*pos] == '"') {
         // String literal
@@ -108,64 +262,186 @@ Token getNextToken(char *line, int *pos) {
             (*pos)++;
         }
         if (line[*pos] == '"') {
-            int len = *pos - start;
-            if (len >= MAX_LINE_LENGTH) {
-                len = MAX_LINE_LENGTH - 1;
-            }
-            strncpy(token.value, &line[start], len);
-            token.value[len] = '\0';
+            token.value = internString(&line[start], *pos - start);
             token.type = TOKEN_STRING;
             (*pos)++;
             return token;
         } else {
-            printf("Unterminated string\n");
+            outPrintf("Unterminated string\n");
             token.type = TOKEN_EOF;
             return token;
         }
-    } else if (strchr("+-*/=<>(),", line[*pos]) != NULL) {
-        // Operator or punctuation
-        token.value[0] = line[*pos];
-        token.value[1] = '\0';
+    } else if (strchr("+-*/^=<>(),;&", line[*pos]) != NULL) {
+        // Operator or punctuation (<>, <= and >= are single tokens)
+        int len = 1;
+        if ((line[*pos] == '<' && (line[*pos + 1] == '>' || line[*pos + 1] == '=')) ||
+            (line[*pos] == '>' && line[*pos + 1] == '=')) {
+            len = 2;
+        }
+        token.value = internString(&line[*pos], len);
         token.type = TOKEN_OPERATOR;
-        (*pos)++;
+        *pos += len;
         return token;
     } else if (line[*pos] == ':') {
         // Colon
-        token.value[0] = line[*pos];
-        token.value[1] = '\0';
+        token.value = internString(&line[*pos], 1);
         token.type = TOKEN_COLON;
         (*pos)++;
         return token;
     } else {
         // Invalid character
-        printf("Invalid character: %c\n", line[*pos]);
+        outPrintf("Invalid character: %c\n", line[*pos]);
         (*pos)++;
         token.type = TOKEN_EOF;
         return token;
     }
 }
 
-// Tokenize a line of input and store tokens in the Line structure
-void tokenizeLine(char *line, Line *lineStruct) {
+// True if text[0..len) is a number, with or without a sign
+static bool isDataNumber(const char *text, int len) {
+    int sign = text[0] == '+' || text[0] == '-' ? 1 : 0;
+    int hexLen = hexLiteralLength(text + sign);
+    int numLen = hexLen ? hexLen : decimalLiteralLength(text + sign);
+    return numLen > 0 && sign + numLen == len;
+}
+
+// Next token of a DATA statement. Quoted strings, numbers and commas lex as
+// anywhere else, but any other item becomes one string token holding its
+// text as written, up to the comma, colon or comment that ends it (without
+// the blanks around it), so DATA A  B, X=1 reads back as "A  B" and "X=1".
+static Token getDataToken(const char *line, int *pos) {
+    while (line[*pos] == ' ' || line[*pos] == '\t') {
+        (*pos)++;
+    }
+    int start = *pos;
+    int end = start;
+    while (line[end] != '\0' && line[end] != '\n' && line[end] != '\r' && line[end] != ',' && line[end] != ':' &&
+           line[end] != '\'') {
+        end++;
+    }
+    int len = end - start;
+    while (len > 0 && (line[start + len - 1] == ' ' || line[start + len - 1] == '\t')) {
+        len--;
+    }
+    if (len == 0 || line[start] == '"' || isDataNumber(&line[start], len)) {
+        return getNextToken(line, pos);
+    }
+    Token token;
+    initToken(&token);
+    token.type = TOKEN_STRING;
+    token.value = internString(&line[start], len);
+    *pos = end;
+    return token;
+}
+
+// A token that ends a statement: a colon, or a ' comment after a statement
+static bool endsStatement(Token *tokens, int i, int statementStart) {
+    return tokens[i].type == TOKEN_COLON || (tokens[i].keyword == KW_REM && i > statementStart);
+}
+
+// Build the table of where each colon-separated statement starts.
+// The extra entry at the end lets statement s span
+// statements[s] .. statements[s + 1] - 2 without a special case for the last.
+static bool buildStatementTable(Line *lineStruct) {
+    int numStatements = 1;
+    int start = 0;
+    for (int i = 0; i < lineStruct->numTokens; i++) {
+        if (endsStatement(lineStruct->tokens, i, start)) {
+            numStatements++;
+            start = i + 1;
+        }
+    }
+    lineStruct->statements = malloc((numStatements + 1) * sizeof(int));
+    if (!lineStruct->statements) {
+        perror("malloc");
+        return false;
+    }
+    int s = 0;
+    lineStruct->statements[s++] = 0;
+    for (int i = 0; i < lineStruct->numTokens; i++) {
+        if (endsStatement(lineStruct->tokens, i, lineStruct->statements[s - 1])) {
+            lineStruct->statements[s++] = i + 1;
+        }
+    }
+    lineStruct->statements[s] = lineStruct->numTokens + 1;
+    lineStruct->numStatements = numStatements;
+    return true;
+}
+
+// Tokenize a line of input and store tokens in the Line structure.
+// Tokens are collected in a reusable scratch buffer and then copied into a
+// heap array sized to the line, which the Line owns (see freeLine).
+void tokenizeLine(const char *line, Line *lineStruct) {
+    static Token *scratch = NULL;
+    static int scratchCapacity = 0;
     int pos = 0;
-    lineStruct->numTokens = 0;
+    int numTokens = 0;
 
     // Check for a line number
     Token firstToken = getNextToken(line, &pos);
-    if (firstToken.type == TOKEN_NUMBER) {
-        lineStruct->lineNumber = atoi(firstToken.value);
+    if (firstToken.type == TOKEN_NUMBER && firstToken.isInteger) {
+        lineStruct->lineNumber = firstToken.integer;
     } else {
         lineStruct->lineNumber = 0;
         pos = 0;
     }
 
     // Tokenize the rest of the line
-    size_t lineLength = strlen(line);
-    while (pos < lineLength) {
-        Token token = getNextToken(line, &pos);
+    bool inData = false; // In a DATA statement, which lexes its items as written
+    while (1) {
+        Token token = inData ? getDataToken(line, &pos) : getNextToken(line, &pos);
         if (token.type == TOKEN_EOF || token.type == TOKEN_NEWLINE) {
             break;
         }
-        lineStruct->tokens[lineStruct->numTokens++] = token;
+        if (token.keyword == KW_DATA) {
+            inData = true;
+        } else if (token.type == TOKEN_COLON || token.keyword == KW_REM) {
+            inData = false;
+        }
+        if (numTokens == scratchCapacity) {
+            int newCapacity = scratchCapacity ? scratchCapacity * 2 : 64;
+            Token *newScratch = realloc(scratch, newCapacity * sizeof(Token));
+            if (!newScratch) {
+                perror("realloc");
+                break;
+            }
+            scratch = newScratch;
+            scratchCapacity = newCapacity;
+        }
+        scratch[numTokens++] = token;
+    }
+
+    stats.linesLexed++;
+    stats.tokensLexed += numTokens;
+    lineStruct->numTokens = 0;
+    lineStruct->tokens = NULL;
+    lineStruct->numStatements = 0;
+    lineStruct->statements = NULL;
+    if (numTokens > 0) {
+        lineStruct->tokens = malloc(numTokens * sizeof(Token));
+        if (!lineStruct->tokens) {
+            perror("malloc");
+            return;
+        }
+        stats.allocations += 2; // Tokens, and statements below
+        memcpy(lineStruct->tokens, scratch, numTokens * sizeof(Token));
+        lineStruct->numTokens = numTokens;
+        if (!buildStatementTable(lineStruct)) {
+            freeLine(lineStruct);
+        }
+    }
+}
+
+// Release the token and statement arrays owned by a Line, with any expressions compiled from it
+void freeLine(Line *line) {
+    for (int i = 0; i < line->numTokens; i++) {
+        free(line->tokens[i].expr);
+        freeUsingFormat(line->tokens[i].format);
     }
+    free(line->tokens);
+    free(line->statements);
+    line->tokens = NULL;
+    line->numTokens = 0;
+    line->statements = NULL;
+    line->numStatements = 0;
 }
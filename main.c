@@ -2,21 +2,35 @@
 
 
 // Global data structures (unchanged)
-Line program[MAX_NUM_LINES];
+Line **program = NULL; // Sorted by line number
 int numLines = 0;
-Variable variables[MAX_VARIABLES];
+int programCapacity = 0;
+unsigned int programGeneration = 1;
+double *numValues = NULL;
+int64_t *intValues = NULL;
+String *strValues = NULL;
+VariableInfo *variableInfo = NULL;
 int numVariables = 0;
-double dataValues[MAX_DATA_VALUES];
-int numDataValues = 0;
-int dataReadPtr = 0; // Pointer for READ statement
+int variablesCapacity = 0;
+unsigned int symbolGeneration = 1;
+DataItem *dataItems = NULL;
+int numDataItems = 0;
+int dataItemsCapacity = 0;
+int dataReadPtr = 0; // Next item for READ
 int currentLine = 0; // Current line being executed
+int currentStatement = 0; // Statement within the current line
 int nextLine = 0; // Next line to be executed
+int nextStatement = 0; // Statement within the next line
 bool running = false;
 
 // for gosub
-int gosubStack[MAX_GOSUB_STACK];
+GosubFrame gosubStack[MAX_GOSUB_STACK];
 int gosubStackPtr = 0;
 
+// for FOR/NEXT
+LoopFrame loopStack[MAX_LOOP_STACK];
+int loopStackPtr = 0;
+
 // Environment variables
 bool emu_amiga_m68k = false;
 
@@ -26,49 +40,62 @@ char **filename_completion(const char *text, int start, int end) {
     return rl_completion_matches(text, rl_filename_completion_function);
 }
 
+// The benchmarks (bench/microbench.c) link everything else and bring their own main
+#ifndef CBSH_NO_MAIN
+
+// Parse the optional range after LIST: "LIST 10", "LIST 20-50", "LIST -50", "LIST 20-"
+static void listRange(Token *tokens, int numTokens, int *startLine, int *endLine) {
+    int i = 1;
+    *startLine = 0;
+    *endLine = -1;
+    if (i < numTokens && tokens[i].type == TOKEN_NUMBER) {
+        *startLine = tokens[i++].integer;
+        *endLine = *startLine;
+    }
+    if (i < numTokens && strcmp(tokens[i].value, "-") == 0) {
+        i++;
+        *endLine = -1;
+        if (i < numTokens && tokens[i].type == TOKEN_NUMBER) {
+            *endLine = tokens[i].integer;
+        }
+    }
+}
+
 int main(int argc, char *argv[]) {
-    char *lineBuffer;
+    initOutput();
+    initVectorKernels();
+    initStats();
 
     // Install filename completion
     rl_attempted_completion_function = filename_completion;
 
+    // --profile[=FILE]: profile runs, writing collapsed call stacks to FILE
+    if (argc > 1 && strncmp(argv[1], "--profile", 9) == 0 && (argv[1][9] == '\0' || argv[1][9] == '=')) {
+        profileRuns = true;
+        profileStacksPath = argv[1][9] == '=' ? argv[1] + 10 : NULL;
+        argv++;
+        argc--;
+    }
+
     if (argc > 1) {
-        // Script mode (unchanged)
-        FILE *file = fopen(argv[1], "r");
-        if (file == NULL) {
-            printf("Error opening file: %s\n", argv[1]);
+        // Script mode
+        if (!loadScript(argv[1])) {
             return 1;
         }
-
-        // Check for shebang (unchanged)
-        if (fgets(lineBuffer, sizeof(lineBuffer), file) != NULL) {
-            if (strncmp(lineBuffer, "#!/usr/bin/env cbsh", 19) != 0 && strncmp(lineBuffer, "#!/usr/bin/CBSH", 15) != 0) {
-                rewind(file);
-            }
-        }
-
-        while (fgets(lineBuffer, MAX_LINE_LENGTH, file) != NULL) {
-            lineBuffer[strcspn(lineBuffer, "\n")] = 0;
-
-            Line newLine;
-            tokenizeLine(lineBuffer, &newLine);
-
-            if (newLine.lineNumber == 0) {
-                executeLine(&newLine);
-            } else {
-                addLine(&newLine);
-            }
+        if (profileRuns) {
+            runProfiled(0, profileStacksPath);
+        } else {
+            runProgram(0);
         }
-        fclose(file);
-
-        runProgram(0);
     } else {
         // Interactive mode
-        printf("CBSH - Commodore BASIC Shell, version 1.1\n\n");
-        printf("READY.\n");
+        outPrintf("CBSH - Commodore BASIC Shell, version 1.1\n\n");
+        outPrintf("READY.\n");
         
         while (1) {
-            lineBuffer = readline("cbsh> ");
+            outFlush();
+            reapJobs(); // Background jobs that finished do not linger as zombies
+            char *lineBuffer = readline("cbsh> ");
             if (!lineBuffer) {
                 break; // Exit on EOF (Ctrl+D)
             }
@@ -82,15 +109,18 @@ int main(int argc, char *argv[]) {
             if (newLine.lineNumber == 0) {
                 if (newLine.numTokens > 0) {
                     if (newLine.tokens[0].keyword == KW_LIST) {
-                        executeList(0, -1);
+                        int startLine, endLine;
+                        listRange(newLine.tokens, newLine.numTokens, &startLine, &endLine);
+                        executeList(startLine, endLine);
                     } else if (newLine.tokens[0].keyword == KW_NEW) {
                         executeNew();
                     } else if (newLine.tokens[0].keyword == KW_RUN) {
-                        runProgram(0);
+                        executeRun(newLine.tokens, newLine.numTokens);
                     } else {
                         executeLine(&newLine);
                     }
                 }
+                freeLine(&newLine);
             } else {
                 addLine(&newLine);
             }
@@ -100,3 +130,5 @@ int main(int argc, char *argv[]) {
 
     return 0;
 }
+
+#endif // CBSH_NO_MAIN
@@ -0,0 +1,297 @@
+#include "cbsh.h"
+
+// MAT statements (as in Dartmouth BASIC): whole-array arithmetic on numeric
+// arrays, run as single calls into the vector kernels instead of element by
+// element through FOR loops. MAT works on every element, subscript 0
+// included, and a result array takes the shape of the operands.
+//
+//   MAT C = A + B     MAT C = A - B     MAT C = A * B (matrix product)
+//   MAT C = (K) * A   MAT C = A         MAT C = ZER | CON | IDN
+//   MAT READ A, B     MAT PRINT A, B
+//
+// SUM(A) and DOT(A, B) in expressions use the same kernels.
+
+static bool isOperatorToken(Token *token, const char *op) {
+    return token->type == TOKEN_OPERATOR && strcmp(token->value, op) == 0;
+}
+
+// Slot of the numeric array an identifier token names, or -1 (after reporting)
+static int matSlot(Token *token) {
+    if (token->type != TOKEN_IDENTIFIER) {
+        outPrintf("Invalid MAT statement: expected an array name\n");
+        return -1;
+    }
+    int slot = getArraySlot(token->value);
+    if (variableInfo[slot].type != VAR_TYPE_NUMERIC) {
+        outPrintf("MAT needs numeric arrays: %s\n", token->value);
+        return -1;
+    }
+    return slot;
+}
+
+// Elements of an array that must already be dimensioned, or NULL (after reporting)
+static Array *matOperand(int slot, Token *token) {
+    Array *array = variableInfo[slot].array;
+    if (!array) {
+        outPrintf("Array not dimensioned: %s\n", token->value);
+    }
+    return array;
+}
+
+// Give the result array the shape wanted, keeping its storage when it already has it
+static Array *matResult(int slot, int numDims, const int *extents) {
+    Array *array = variableInfo[slot].array;
+    if (array && array->numDims == numDims && memcmp(array->extents, extents, numDims * sizeof(int)) == 0) {
+        return array;
+    }
+    return dimensionArray(slot, numDims, extents);
+}
+
+// True if two arrays have the same shape
+static bool sameShape(Array *a, Array *b) {
+    return a->numDims == b->numDims && memcmp(a->extents, b->extents, a->numDims * sizeof(int)) == 0;
+}
+
+// MAT C = A * B: matrix by matrix, matrix by column vector or row vector by matrix
+static void matMultiply(int resultSlot, Array *a, Array *b) {
+    if (a->numDims > 2 || b->numDims > 2 || (a->numDims == 1 && b->numDims == 1)) {
+        outPrintf("MAT * needs a matrix operand (use DOT for vectors)\n");
+        return;
+    }
+    // View both as matrices: a vector on the left is a row, on the right a column
+    int rows = a->numDims == 2 ? a->extents[0] : 1;
+    int inner = a->extents[a->numDims - 1];
+    int innerB = b->extents[0];
+    int columns = b->numDims == 2 ? b->extents[1] : 1;
+    if (inner != innerB) {
+        outPrintf("MAT *: sizes do not match (%d and %d)\n", inner, innerB);
+        return;
+    }
+
+    // Compute into fresh storage, since the result may be one of the operands
+    double *product = calloc((size_t)rows * columns, sizeof(double));
+    if (!product) {
+        outPrintf("Out of memory for MAT *\n");
+        return;
+    }
+    for (int i = 0; i < rows; i++) {
+        double *row = product + (size_t)i * columns;
+        if (b->numDims == 1) {
+            row[0] = vectorKernels.dot(a->numbers + (size_t)i * inner, b->numbers, inner);
+            continue;
+        }
+        for (int k = 0; k < inner; k++) {
+            vectorKernels.axpy(row, b->numbers + (size_t)k * columns, a->numbers[(size_t)i * inner + k], columns);
+        }
+    }
+
+    int extents[2];
+    int numDims = 0;
+    if (a->numDims == 2) {
+        extents[numDims++] = rows;
+    }
+    if (b->numDims == 2) {
+        extents[numDims++] = columns;
+    }
+    Array *result = matResult(resultSlot, numDims, extents);
+    if (result) {
+        memcpy(result->numbers, product, (size_t)result->size * sizeof(double));
+    }
+    free(product);
+}
+
+// MAT C = ZER, CON or IDN: fill an already dimensioned array
+static void matFill(int slot, Token *name, Token *token) {
+    Array *array = matOperand(slot, name);
+    if (!array) {
+        return;
+    }
+    if (strcasecmp(token->value, "ZER") == 0) {
+        memset(array->numbers, 0, (size_t)array->size * sizeof(double));
+    } else if (strcasecmp(token->value, "CON") == 0) {
+        for (int i = 0; i < array->size; i++) {
+            array->numbers[i] = 1;
+        }
+    } else if (array->numDims != 2 || array->extents[0] != array->extents[1]) {
+        outPrintf("MAT IDN needs a square matrix: %s\n", name->value);
+    } else {
+        memset(array->numbers, 0, (size_t)array->size * sizeof(double));
+        for (int i = 0; i < array->extents[0]; i++) {
+            array->numbers[(size_t)i * array->extents[0] + i] = 1;
+        }
+    }
+}
+
+// MAT READ A, B, ...: fill arrays from DATA in row-major order
+static void matRead(Token *tokens, int numTokens) {
+    for (int i = 0; i < numTokens; i += 2) {
+        int slot = matSlot(&tokens[i]);
+        Array *array = slot < 0 ? NULL : matOperand(slot, &tokens[i]);
+        if (!array) {
+            return;
+        }
+        for (int e = 0; e < array->size; e++) {
+            DataItem *item = nextDataItem();
+            if (!item) {
+                outPrintf("Out of DATA\n");
+                return;
+            }
+            if (!item->isNumber) {
+                outPrintf("Type mismatch: DATA item %s is not a number\n", item->text);
+                return;
+            }
+            array->numbers[e] = item->number;
+        }
+        if (i + 1 < numTokens && !isOperatorToken(&tokens[i + 1], ",")) {
+            outPrintf("Invalid MAT READ statement\n");
+            return;
+        }
+    }
+}
+
+// MAT PRINT A, B, ...: one line per row, a blank line after each array
+static void matPrint(Token *tokens, int numTokens) {
+    for (int i = 0; i < numTokens; i += 2) {
+        int slot = matSlot(&tokens[i]);
+        Array *array = slot < 0 ? NULL : matOperand(slot, &tokens[i]);
+        if (!array) {
+            return;
+        }
+        int columns = array->extents[array->numDims - 1];
+        for (int e = 0; e < array->size; e++) {
+            outNumber(array->numbers[e]);
+            if ((e + 1) % columns == 0) {
+                outPutc('\n');
+            }
+        }
+        outPutc('\n');
+        if (i + 1 < numTokens && !isOperatorToken(&tokens[i + 1], ",")) {
+            outPrintf("Invalid MAT PRINT statement\n");
+            return;
+        }
+    }
+}
+
+// Execute MAT command
+void executeMat(Token *tokens, int numTokens) {
+    if (numTokens >= 3 && tokens[1].keyword == KW_READ) {
+        matRead(tokens + 2, numTokens - 2);
+        return;
+    }
+    if (numTokens >= 3 && tokens[1].keyword == KW_PRINT) {
+        matPrint(tokens + 2, numTokens - 2);
+        return;
+    }
+    if (numTokens < 4 || !isOperatorToken(&tokens[2], "=")) {
+        outPrintf("Invalid MAT statement\n");
+        return;
+    }
+
+    // Look every array up before taking pointers: a lookup can move the symbol table
+    int resultSlot = matSlot(&tokens[1]);
+    if (resultSlot < 0) {
+        return;
+    }
+    Token *rhs = tokens + 3;
+    int numRhs = numTokens - 3;
+
+    if (numRhs == 1 && rhs[0].type == TOKEN_IDENTIFIER &&
+        (strcasecmp(rhs[0].value, "ZER") == 0 || strcasecmp(rhs[0].value, "CON") == 0 ||
+         strcasecmp(rhs[0].value, "IDN") == 0)) {
+        matFill(resultSlot, &tokens[1], &rhs[0]);
+        return;
+    }
+
+    if (numRhs == 1) {
+        int slot = matSlot(&rhs[0]);
+        Array *source = slot < 0 ? NULL : matOperand(slot, &rhs[0]);
+        Array *result = source ? matResult(resultSlot, source->numDims, source->extents) : NULL;
+        if (result && result != source) {
+            memcpy(result->numbers, source->numbers, (size_t)source->size * sizeof(double));
+        }
+        return;
+    }
+
+    // (K) * A
+    if (isOperatorToken(&rhs[0], "(")) {
+        Value factor;
+        int consumed;
+        if (!evaluatePrefix(rhs + 1, numRhs - 1, &factor, &consumed)) {
+            return;
+        }
+        int pos = 1 + consumed;
+        if (pos + 3 != numRhs || !isOperatorToken(&rhs[pos], ")") || !isOperatorToken(&rhs[pos + 1], "*")) {
+            outPrintf("Invalid MAT statement\n");
+            return;
+        }
+        if (factor.type != VAR_TYPE_NUMERIC) {
+            outPrintf("Type mismatch\n");
+            releaseValue(&factor);
+            return;
+        }
+        int slot = matSlot(&rhs[pos + 2]);
+        Array *source = slot < 0 ? NULL : matOperand(slot, &rhs[pos + 2]);
+        Array *result = source ? matResult(resultSlot, source->numDims, source->extents) : NULL;
+        if (result) {
+            vectorKernels.scale(result->numbers, source->numbers, factor.num, source->size);
+        }
+        return;
+    }
+
+    // A + B, A - B, A * B
+    if (numRhs != 3 || rhs[1].type != TOKEN_OPERATOR || strlen(rhs[1].value) != 1 || !strchr("+-*", rhs[1].value[0])) {
+        outPrintf("Invalid MAT statement\n");
+        return;
+    }
+    int slotA = matSlot(&rhs[0]);
+    int slotB = slotA < 0 ? -1 : matSlot(&rhs[2]);
+    Array *a = slotB < 0 ? NULL : matOperand(slotA, &rhs[0]);
+    Array *b = a ? matOperand(slotB, &rhs[2]) : NULL;
+    if (!b) {
+        return;
+    }
+    if (rhs[1].value[0] == '*') {
+        matMultiply(resultSlot, a, b);
+        return;
+    }
+    if (!sameShape(a, b)) {
+        outPrintf("MAT %s: arrays differ in shape\n", rhs[1].value);
+        return;
+    }
+    Array *result = matResult(resultSlot, a->numDims, a->extents);
+    if (!result) {
+        return;
+    }
+    if (rhs[1].value[0] == '+') {
+        vectorKernels.add(result->numbers, a->numbers, b->numbers, a->size);
+    } else {
+        vectorKernels.subtract(result->numbers, a->numbers, b->numbers, a->size);
+    }
+}
+
+// SUM(A): total of every element. Returns false (after reporting) if A is not dimensioned.
+bool arraySum(int slot, double *result) {
+    Array *array = variableInfo[slot].array;
+    if (!array || variableInfo[slot].type != VAR_TYPE_NUMERIC) {
+        outPrintf("SUM needs a dimensioned numeric array\n");
+        return false;
+    }
+    *result = vectorKernels.sum(array->numbers, array->size);
+    return true;
+}
+
+// DOT(A, B): sum of the products of matching elements of two arrays of the same size
+bool arrayDot(int slotA, int slotB, double *result) {
+    Array *a = variableInfo[slotA].array;
+    Array *b = variableInfo[slotB].array;
+    if (!a || !b || variableInfo[slotA].type != VAR_TYPE_NUMERIC || variableInfo[slotB].type != VAR_TYPE_NUMERIC) {
+        outPrintf("DOT needs dimensioned numeric arrays\n");
+        return false;
+    }
+    if (a->size != b->size) {
+        outPrintf("DOT: arrays differ in size (%d and %d)\n", a->size, b->size);
+        return false;
+    }
+    *result = vectorKernels.dot(a->numbers, b->numbers, a->size);
+    return true;
+}
@@ -0,0 +1,112 @@
+#include "cbsh.h"
+
+// Buffered output. Everything the interpreter prints to stdout goes through
+// here, so PRINT output and messages stay in order, and output reaches the
+// terminal or pipe in large write() calls instead of one stdio call per item.
+// The buffer is flushed when full, before anything else may write to the
+// terminal (INPUT, LOAD, the prompt), at END and at exit. In line-buffered
+// mode (the default on a terminal, SET LINEBUFFER) every newline flushes too.
+
+#define OUTPUT_BUFFER_SIZE 65536
+
+bool lineBufferedOutput = false;
+
+static char outputBuffer[OUTPUT_BUFFER_SIZE];
+static size_t outputLength = 0;
+
+// Write a byte range straight to stdout, retrying short writes
+static void writeAll(const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(STDOUT_FILENO, data, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return; // Nowhere to report it; drop the output
+        }
+        stats.bytesPrinted += written;
+        data += written;
+        len -= written;
+    }
+}
+
+// Write out everything buffered so far
+void outFlush() {
+    if (outputLength > 0) {
+        writeAll(outputBuffer, outputLength);
+        outputLength = 0;
+    }
+}
+
+// Set up buffering: line-buffered on a terminal, and flushed at exit
+void initOutput() {
+    lineBufferedOutput = isatty(STDOUT_FILENO);
+    atexit(outFlush);
+}
+
+// Append bytes to the buffer
+void outWrite(const char *data, size_t len) {
+    if (len > OUTPUT_BUFFER_SIZE - outputLength) {
+        outFlush();
+        if (len >= OUTPUT_BUFFER_SIZE) {
+            writeAll(data, len); // Too big to be worth copying
+            return;
+        }
+    }
+    memcpy(outputBuffer + outputLength, data, len);
+    outputLength += len;
+    if (lineBufferedOutput && memchr(data, '\n', len)) {
+        outFlush();
+    }
+}
+
+// Append one character
+void outPutc(char c) {
+    if (outputLength == OUTPUT_BUFFER_SIZE) {
+        outFlush();
+    }
+    outputBuffer[outputLength++] = c;
+    if (lineBufferedOutput && c == '\n') {
+        outFlush();
+    }
+}
+
+// Append a number formatted as PRINT shows it, straight into the buffer
+void outNumber(double value) {
+    if (OUTPUT_BUFFER_SIZE - outputLength < NUMBER_BUFFER_SIZE) {
+        outFlush();
+    }
+    outputLength += formatNumber(value, outputBuffer + outputLength);
+}
+
+// printf into the buffer, formatting in place when it fits
+void outPrintf(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    size_t room = OUTPUT_BUFFER_SIZE - outputLength;
+    int len = vsnprintf(outputBuffer + outputLength, room, format, args);
+    va_end(args);
+    if (len < 0) {
+        return;
+    }
+
+    if ((size_t)len < room) {
+        const char *text = outputBuffer + outputLength;
+        outputLength += len;
+        if (lineBufferedOutput && memchr(text, '\n', len)) {
+            outFlush();
+        }
+        return;
+    }
+
+    // Did not fit: format again into a buffer of the right size
+    char *text = malloc(len + 1);
+    if (!text) {
+        return;
+    }
+    va_start(args, format);
+    vsnprintf(text, len + 1, format, args);
+    va_end(args);
+    outWrite(text, len);
+    free(text);
+}
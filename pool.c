@@ -0,0 +1,116 @@
+#include "cbsh.h"
+
+// Interned string pool: token text lives here instead of inline in each Token.
+// Strings are bump-allocated out of large blocks and deduplicated through an
+// open-addressing hash table, so equal strings share one copy and pointers
+// stay valid until the pool is reset (NEW).
+
+#define POOL_BLOCK_SIZE 65536
+
+typedef struct PoolBlock {
+    struct PoolBlock *next;
+    size_t used;
+    size_t size;
+    char data[];
+} PoolBlock;
+
+typedef struct {
+    const char *str;
+    unsigned int hash;
+    unsigned int len;
+} PoolEntry;
+
+static PoolBlock *poolBlocks = NULL;
+static PoolEntry *poolTable = NULL;
+static size_t poolCapacity = 0; // Always a power of two
+static size_t poolCount = 0;
+
+// FNV-1a hash of a byte range
+static unsigned int hashBytes(const char *text, size_t len) {
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Copy a string into the current block, starting a new block if needed
+static char *poolAlloc(size_t size) {
+    if (!poolBlocks || poolBlocks->size - poolBlocks->used < size) {
+        size_t blockSize = size > POOL_BLOCK_SIZE ? size : POOL_BLOCK_SIZE;
+        PoolBlock *block = malloc(sizeof(PoolBlock) + blockSize);
+        if (!block) {
+            perror("malloc");
+            exit(1);
+        }
+        block->next = poolBlocks;
+        block->used = 0;
+        block->size = blockSize;
+        poolBlocks = block;
+    }
+    char *ptr = poolBlocks->data + poolBlocks->used;
+    poolBlocks->used += size;
+    return ptr;
+}
+
+// Double the hash table and reinsert all entries
+static void growPoolTable() {
+    size_t newCapacity = poolCapacity ? poolCapacity * 2 : 1024;
+    PoolEntry *newTable = calloc(newCapacity, sizeof(PoolEntry));
+    if (!newTable) {
+        perror("calloc");
+        exit(1);
+    }
+    for (size_t i = 0; i < poolCapacity; i++) {
+        if (poolTable[i].str) {
+            size_t slot = poolTable[i].hash & (newCapacity - 1);
+            while (newTable[slot].str) {
+                slot = (slot + 1) & (newCapacity - 1);
+            }
+            newTable[slot] = poolTable[i];
+        }
+    }
+    free(poolTable);
+    poolTable = newTable;
+    poolCapacity = newCapacity;
+}
+
+// Return the pooled copy of text[0..len), adding it if not already present
+const char *internString(const char *text, size_t len) {
+    if (poolCount * 2 >= poolCapacity) {
+        growPoolTable();
+    }
+
+    unsigned int hash = hashBytes(text, len);
+    size_t slot = hash & (poolCapacity - 1);
+    while (poolTable[slot].str) {
+        PoolEntry *entry = &poolTable[slot];
+        if (entry->hash == hash && entry->len == len && memcmp(entry->str, text, len) == 0) {
+            return entry->str;
+        }
+        slot = (slot + 1) & (poolCapacity - 1);
+    }
+
+    char *copy = poolAlloc(len + 1);
+    memcpy(copy, text, len);
+    copy[len] = '\0';
+    poolTable[slot].str = copy;
+    poolTable[slot].hash = hash;
+    poolTable[slot].len = (unsigned int)len;
+    poolCount++;
+    return copy;
+}
+
+// Release every pooled string (all Tokens referring to them must be gone)
+void resetStringPool() {
+    while (poolBlocks) {
+        PoolBlock *next = poolBlocks->next;
+        free(poolBlocks);
+        poolBlocks = next;
+    }
+    if (poolTable) {
+        memset(poolTable, 0, poolCapacity * sizeof(PoolEntry));
+    }
+    poolCount = 0;
+}
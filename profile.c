@@ -0,0 +1,337 @@
+#include "cbsh.h"
+
+// Statement profiler for RUN PROFILE and --profile. While it is on, every
+// program statement entered is counted, and the time until the next one
+// starts (clock_gettime) is charged to it, along with the GOSUB call sites
+// active at the time. When the run ends, the hot lines are printed to
+// stderr, sorted by time, and the time per call stack can be written in
+// the collapsed format flame graph tools read ("10;200;250 1234", one
+// frame per line number, outermost first, weighted in microseconds).
+//
+// When profiling is off the cost is one test of a flag per statement in
+// the tree-walker, and none in the VM, which switches dispatch tables.
+
+bool profiling = false;
+bool profileRuns = false; // --profile: profile every RUN
+const char *profileStacksPath = NULL; // --profile=FILE: where RUN writes collapsed stacks
+
+typedef struct {
+    uint64_t count;
+    uint64_t nanos;
+} ProfileCounter;
+
+// A distinct call stack: its frames (line indices) live in stackFrames
+typedef struct {
+    unsigned int hash;
+    int start;
+    int depth;
+    uint64_t nanos;
+} StackRecord;
+
+static ProfileCounter *counters = NULL; // One per statement of the program
+static int *firstCounter = NULL; // Index of each line's first statement counter
+static unsigned int profiledGeneration; // The program the counters were laid out for
+static int current = -1; // Counter being charged, -1 for none
+static uint64_t lastSample;
+
+static char *stacksPath = NULL; // NULL unless collecting call stacks
+static StackRecord *stacks = NULL;
+static int numStacks = 0;
+static int stacksCapacity = 0;
+static int *stackIndex = NULL; // Hash table of record indices, -1 when empty
+static int stackIndexCapacity = 0;
+static int *stackFrames = NULL;
+static int numStackFrames = 0;
+static int stackFramesCapacity = 0;
+static int currentStack = -1;
+
+// Monotonic time in nanoseconds
+static uint64_t profileClock() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+// Make room for count more items in a growable array
+static void *reserve(void *array, int *capacity, int used, int count, size_t itemSize) {
+    if (used + count <= *capacity) {
+        return array;
+    }
+    int newCapacity = *capacity ? *capacity * 2 : 256;
+    while (newCapacity < used + count) {
+        newCapacity *= 2;
+    }
+    void *newArray = realloc(array, newCapacity * itemSize);
+    if (!newArray) {
+        perror("realloc");
+        exit(1);
+    }
+    *capacity = newCapacity;
+    return newArray;
+}
+
+// Hash the current call stack: the line of each GOSUB, then the line running
+static unsigned int stackHash(int line) {
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < gosubStackPtr; i++) {
+        hash = (hash ^ (unsigned int)gosubStack[i].returnLine) * 16777619u;
+    }
+    return (hash ^ (unsigned int)line) * 16777619u;
+}
+
+// True if a record holds the current call stack
+static bool sameStack(StackRecord *record, unsigned int hash, int line) {
+    if (record->hash != hash || record->depth != gosubStackPtr + 1) {
+        return false;
+    }
+    int *frames = stackFrames + record->start;
+    for (int i = 0; i < gosubStackPtr; i++) {
+        if (frames[i] != gosubStack[i].returnLine) {
+            return false;
+        }
+    }
+    return frames[gosubStackPtr] == line;
+}
+
+// Record of the current call stack, added if it is new
+static int findStack(int line) {
+    unsigned int hash = stackHash(line);
+    if ((numStacks + 1) * 2 > stackIndexCapacity) {
+        int newCapacity = stackIndexCapacity ? stackIndexCapacity * 2 : 1024;
+        int *newIndex = malloc(newCapacity * sizeof(int));
+        if (!newIndex) {
+            perror("malloc");
+            exit(1);
+        }
+        for (int i = 0; i < newCapacity; i++) {
+            newIndex[i] = -1;
+        }
+        for (int i = 0; i < numStacks; i++) {
+            int pos = stacks[i].hash & (newCapacity - 1);
+            while (newIndex[pos] != -1) {
+                pos = (pos + 1) & (newCapacity - 1);
+            }
+            newIndex[pos] = i;
+        }
+        free(stackIndex);
+        stackIndex = newIndex;
+        stackIndexCapacity = newCapacity;
+    }
+
+    int pos = hash & (stackIndexCapacity - 1);
+    while (stackIndex[pos] != -1) {
+        if (sameStack(&stacks[stackIndex[pos]], hash, line)) {
+            return stackIndex[pos];
+        }
+        pos = (pos + 1) & (stackIndexCapacity - 1);
+    }
+
+    stacks = reserve(stacks, &stacksCapacity, numStacks, 1, sizeof(StackRecord));
+    stackFrames = reserve(stackFrames, &stackFramesCapacity, numStackFrames, gosubStackPtr + 1, sizeof(int));
+    StackRecord *record = &stacks[numStacks];
+    record->hash = hash;
+    record->start = numStackFrames;
+    record->depth = gosubStackPtr + 1;
+    record->nanos = 0;
+    for (int i = 0; i < gosubStackPtr; i++) {
+        stackFrames[numStackFrames++] = gosubStack[i].returnLine;
+    }
+    stackFrames[numStackFrames++] = line;
+    stackIndex[pos] = numStacks;
+    return numStacks++;
+}
+
+// Charge the time since the last sample to the statement and stack running
+static void chargeCurrent(uint64_t now) {
+    if (current >= 0) {
+        counters[current].nanos += now - lastSample;
+    }
+    if (currentStack >= 0) {
+        stacks[currentStack].nanos += now - lastSample;
+    }
+    lastSample = now;
+}
+
+// Start profiling the program as it is now. collapsedPath names a file for
+// the collapsed call stacks, or is NULL.
+void startProfile(const char *collapsedPath) {
+    free(counters);
+    free(firstCounter);
+    firstCounter = malloc((numLines + 1) * sizeof(int));
+    if (!firstCounter) {
+        perror("malloc");
+        exit(1);
+    }
+    int total = 0;
+    for (int i = 0; i < numLines; i++) {
+        firstCounter[i] = total;
+        total += program[i]->numStatements;
+    }
+    firstCounter[numLines] = total;
+    counters = calloc(total + 1, sizeof(ProfileCounter));
+    if (!counters) {
+        perror("malloc");
+        exit(1);
+    }
+    profiledGeneration = programGeneration;
+
+    free(stacksPath);
+    stacksPath = collapsedPath ? strdup(collapsedPath) : NULL;
+    numStacks = 0;
+    numStackFrames = 0;
+    for (int i = 0; i < stackIndexCapacity; i++) {
+        stackIndex[i] = -1;
+    }
+    current = -1;
+    currentStack = -1;
+    lastSample = profileClock();
+    profiling = true;
+}
+
+// A program statement is starting
+void profileStatement(int line, int statement) {
+    if (line < 0 || line >= numLines || programGeneration != profiledGeneration) {
+        return; // The direct line, or a program changed under the run
+    }
+    chargeCurrent(profileClock());
+    current = firstCounter[line] + statement;
+    counters[current].count++;
+    if (stacksPath) {
+        currentStack = findStack(line);
+    }
+}
+
+// Line number of a line index, for reports; the direct line is 0
+static int profileLineNumber(int line) {
+    return line >= 0 && line < numLines ? program[line]->lineNumber : 0;
+}
+
+// Write the collapsed call stacks, one "frame;frame;... microseconds" per line
+static void writeStacks() {
+    FILE *file = fopen(stacksPath, "w");
+    if (!file) {
+        fprintf(stderr, "Cannot write profile stacks to %s: %s\n", stacksPath, strerror(errno));
+        return;
+    }
+    for (int i = 0; i < numStacks; i++) {
+        uint64_t micros = stacks[i].nanos / 1000;
+        if (micros == 0) {
+            continue;
+        }
+        for (int f = 0; f < stacks[i].depth; f++) {
+            fprintf(file, "%s%d", f > 0 ? ";" : "", profileLineNumber(stackFrames[stacks[i].start + f]));
+        }
+        fprintf(file, " %llu\n", (unsigned long long)micros);
+    }
+    fclose(file);
+}
+
+static const ProfileCounter *lineTotals; // For compareLines
+
+// Order line indices by time, hottest first
+static int compareLines(const void *a, const void *b) {
+    uint64_t x = lineTotals[*(const int *)a].nanos;
+    uint64_t y = lineTotals[*(const int *)b].nanos;
+    return (x < y) - (x > y);
+}
+
+// Print a statement's tokens, cut to fit a report row
+static void printStatement(Line *line, int statement) {
+    char text[48];
+    text[0] = '\0'; // An empty statement (10 PRINT "X":) has no tokens
+    int length = 0;
+    for (int t = line->statements[statement]; t < line->statements[statement + 1] - 1; t++) {
+        int written = snprintf(text + length, sizeof(text) - length, "%s%s", length ? " " : "", line->tokens[t].value);
+        if (written < 0 || length + written >= (int)sizeof(text)) {
+            strcpy(text + sizeof(text) - 4, "...");
+            break;
+        }
+        length += written;
+    }
+    fprintf(stderr, "  %s\n", text);
+}
+
+// Print the figures of a report row: for a line, or (lineNumber -1) for statement n of one
+static void printRow(int lineNumber, int n, const ProfileCounter *counter, uint64_t totalNanos) {
+    char label[24];
+    if (lineNumber >= 0) {
+        snprintf(label, sizeof(label), "%d", lineNumber);
+    } else {
+        snprintf(label, sizeof(label), ":%d", n);
+    }
+    fprintf(stderr, "%8s %12llu %12.3f %6.1f%%", label, (unsigned long long)counter->count, counter->nanos / 1e6,
+            totalNanos ? 100.0 * counter->nanos / totalNanos : 0.0);
+}
+
+#define PROFILE_REPORT_LINES 20
+
+// Stop profiling: print the hot lines and write the call stacks if asked
+void finishProfile() {
+    if (!profiling) {
+        return;
+    }
+    chargeCurrent(profileClock());
+    profiling = false;
+    outFlush(); // Keep the report after the program's output
+    if (programGeneration != profiledGeneration) {
+        fprintf(stderr, "Profile discarded: the program changed during the run\n");
+        return;
+    }
+
+    ProfileCounter *totals = calloc(numLines + 1, sizeof(ProfileCounter));
+    int *order = malloc((numLines + 1) * sizeof(int));
+    if (!totals || !order) {
+        perror("malloc");
+        exit(1);
+    }
+    uint64_t statements = 0;
+    uint64_t nanos = 0;
+    for (int i = 0; i < numLines; i++) {
+        for (int c = firstCounter[i]; c < firstCounter[i + 1]; c++) {
+            if (counters[c].count > totals[i].count) {
+                totals[i].count = counters[c].count; // A line runs as often as its busiest statement
+            }
+            totals[i].nanos += counters[c].nanos;
+            statements += counters[c].count;
+        }
+        nanos += totals[i].nanos;
+        order[i] = i;
+    }
+    lineTotals = totals;
+    qsort(order, numLines, sizeof(int), compareLines);
+
+    fprintf(stderr, "\nProfile: %llu statements in %.3f s\n", (unsigned long long)statements, nanos / 1e9);
+    fprintf(stderr, "%8s %12s %12s %7s  %s\n", "Line", "Count", "Time (ms)", "%", "Statement");
+    for (int r = 0; r < numLines && r < PROFILE_REPORT_LINES; r++) {
+        int i = order[r];
+        if (totals[i].count == 0) {
+            break;
+        }
+        Line *line = program[i];
+        printRow(line->lineNumber, 0, &totals[i], nanos);
+        if (line->numStatements == 1) {
+            printStatement(line, 0);
+            continue;
+        }
+        fprintf(stderr, "\n");
+        for (int s = 0; s < line->numStatements; s++) {
+            if (counters[firstCounter[i] + s].count > 0) {
+                printRow(-1, s + 1, &counters[firstCounter[i] + s], nanos);
+                printStatement(line, s);
+            }
+        }
+    }
+
+    if (stacksPath) {
+        writeStacks();
+    }
+    free(totals);
+    free(order);
+}
+
+// Run the program under the profiler, from startLine (0 for the start)
+void runProfiled(int startLine, const char *collapsedPath) {
+    startProfile(collapsedPath);
+    runProgram(startLine);
+    finishProfile();
+}
@@ -1,66 +1,394 @@
 #include "cbsh.h"
 
+// Static FOR/NEXT pairing: each FOR keyword token records the line index of
+// its NEXT in its target field (or -1), so FOR never has to scan for it.
+// Matching is lexical, statement by statement; at run time NEXT works off
+// the loop stack.
+void pairLoops(Line **lines, int count) {
+    static Token **open = NULL; // FOR statements not yet closed
+    static int openCapacity = 0;
+    int numOpen = 0;
+
+    for (int i = 0; i < count; i++) {
+        Line *line = lines[i];
+        for (int s = 0; s < line->numStatements; s++) {
+            Token *tokens = line->tokens + line->statements[s];
+            int numTokens = line->statements[s + 1] - line->statements[s] - 1;
+            if (numTokens == 0) {
+                continue;
+            }
+            if (tokens[0].keyword == KW_FOR) {
+                tokens[0].target = -1;
+                if (numTokens < 2) {
+                    continue;
+                }
+                if (numOpen == openCapacity) {
+                    int newCapacity = openCapacity ? openCapacity * 2 : 32;
+                    Token **newOpen = realloc(open, newCapacity * sizeof(Token *));
+                    if (!newOpen) {
+                        perror("realloc");
+                        return;
+                    }
+                    open = newOpen;
+                    openCapacity = newCapacity;
+                }
+                open[numOpen++] = tokens;
+            } else if (tokens[0].keyword == KW_NEXT) {
+                // NEXT closes the innermost FOR; NEXT A, B closes the FORs of A and B
+                int numVars = 0;
+                for (int t = 1; t < numTokens; t++) {
+                    if (tokens[t].type != TOKEN_IDENTIFIER) {
+                        continue;
+                    }
+                    numVars++;
+                    for (int k = numOpen - 1; k >= 0; k--) {
+                        if (open[k][1].slot == tokens[t].slot) {
+                            open[k][0].target = i;
+                            numOpen = k;
+                            break;
+                        }
+                    }
+                }
+                if (numVars == 0 && numOpen > 0) {
+                    open[--numOpen][0].target = i;
+                }
+            }
+        }
+    }
+}
+
+// Prepare an immediate-mode line the same way RUN prepares the program
+void prepareLine(Line *line) {
+    resolveLineSlots(line);
+    pairLoops(&line, 1);
+}
+
+// Resolve every identifier in the program to its variable slot and pair
+// FOR/NEXT. Only redone when lines have been edited or the variables were
+// reset since last time.
+void prepareProgram() {
+    static unsigned int preparedProgram = 0;
+    static unsigned int preparedSymbols = 0;
+    if (preparedProgram == programGeneration && preparedSymbols == symbolGeneration) {
+        return;
+    }
+    for (int i = 0; i < numLines; i++) {
+        resolveLineSlots(program[i]);
+    }
+    pairLoops(program, numLines);
+    preparedProgram = programGeneration;
+    preparedSymbols = symbolGeneration;
+}
+
+static Line *directLine = NULL; // The line running as DIRECT_LINE, if any
+
+// Run statements from a position until END, the end of the program, or the
+// end of the direct line. Program lines go to the bytecode VM unless
+// SET BYTECODE = FALSE; the direct line is always tree-walked.
+static void runFrom(int line, int statement) {
+    nextLine = line;
+    nextStatement = statement;
+    running = true;
+    if (line != DIRECT_LINE) {
+        prepareProgram();
+    }
+
+    while (running) {
+        Line *current;
+        if (nextLine == DIRECT_LINE) {
+            current = directLine;
+            if (!current || nextStatement >= current->numStatements) {
+                break; // Direct mode never falls through into the program
+            }
+        } else if (nextLine < numLines) {
+            if (useBytecode) {
+                runBytecode(nextLine, nextStatement); // Returns early only to resume the direct line
+                continue;
+            }
+            current = program[nextLine];
+            if (nextStatement >= current->numStatements) {
+                nextLine++;
+                nextStatement = 0;
+                continue;
+            }
+        } else {
+            break; // End of program
+        }
+
+        currentLine = nextLine;
+        currentStatement = nextStatement++;
+        if (profiling || statsEnabled) {
+            countStatement(currentLine, currentStatement);
+        }
+        int start = current->statements[currentStatement];
+        executeStatement(current->tokens + start, current->statements[currentStatement + 1] - start - 1);
+        if (currentLine == DIRECT_LINE && nextLine != DIRECT_LINE) {
+            prepareProgram(); // GOTO, GOSUB or RUN-like jump from direct mode
+        }
+    }
+    running = false;
+}
+
+// Execute a line typed (or read from a script) without a line number
+void executeLine(Line *line) {
+    prepareLine(line);
+    directLine = line;
+    runFrom(DIRECT_LINE, 0);
+    directLine = NULL;
+}
+
 // Run the program from a specific line number
 void runProgram(int startLine) {
+    gosubStackPtr = 0;
+    loopStackPtr = 0;
     currentLine = 0;
-    nextLine = startLine;
-    running = true;
+    currentStatement = 0;
+    dataReadPtr = 0; // RUN starts READ from the first DATA item again
 
     // Find the starting line index
+    int index = 0;
     if (startLine != 0) {
-        int found = 0;
-        for (int i = 0; i < numLines; i++) {
-            if (program[i].lineNumber == startLine) {
-                currentLine = i;
-                nextLine = i;
-                found = 1;
-                break;
-            }
-        }
-        if (!found) {
-            printf("Undefined line %d\n", startLine);
+        index = findLineIndex(startLine);
+        if (index == -1) {
+            outPrintf("Undefined line %d\n", startLine);
             running = false;
             return;
         }
     }
+    runFrom(index, 0);
+}
 
-    while (running) {
-        if (nextLine < numLines) {
-            currentLine = nextLine;
-            nextLine++;
-            executeLine(&program[currentLine]);
+// Binary search for a line number. Returns the index of the line, or the
+// index it would be inserted at (with *found cleared) if it is not present.
+int findLinePosition(int lineNumber, bool *found) {
+    int low = 0;
+    int high = numLines;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (program[mid]->lineNumber < lineNumber) {
+            low = mid + 1;
         } else {
-            running = false; // End of program
+            high = mid;
         }
     }
+    *found = low < numLines && program[low]->lineNumber == lineNumber;
+    return low;
 }
 
-// Add a new line to the program or replace an existing line
-void addLine(Line *newLine) {
-    // Check if the line number already exists
+// Direct-mapped line number -> index table, rebuilt lazily after edits.
+// Only used while line numbers are dense enough for it to stay small.
+#define LINE_INDEX_LIMIT 65536
+
+static int *lineIndexTable = NULL;
+static int lineIndexSize = 0; // Number of entries (highest line number + 1)
+static unsigned int lineIndexGeneration = 0;
+
+// Rebuild the direct-mapped table, or leave it empty if the numbers are too sparse
+static void buildLineIndex() {
+    lineIndexGeneration = programGeneration;
+    lineIndexSize = 0;
+    if (numLines == 0) {
+        return;
+    }
+    int highest = program[numLines - 1]->lineNumber;
+    if (program[0]->lineNumber < 0 || highest >= LINE_INDEX_LIMIT + 8 * numLines) {
+        return;
+    }
+    int *table = realloc(lineIndexTable, (highest + 1) * sizeof(int));
+    if (!table) {
+        return; // Fall back to binary search
+    }
+    lineIndexTable = table;
+    for (int i = 0; i <= highest; i++) {
+        lineIndexTable[i] = -1;
+    }
     for (int i = 0; i < numLines; i++) {
-        if (program[i].lineNumber == newLine->lineNumber) {
-            // Replace the existing line
-            program[i] = *newLine;
-            return;
+        lineIndexTable[program[i]->lineNumber] = i;
+    }
+    lineIndexSize = highest + 1;
+}
+
+// Find the index of a line number in the program, or -1 if it does not exist
+int findLineIndex(int lineNumber) {
+    if (lineIndexGeneration != programGeneration) {
+        buildLineIndex();
+    }
+    if (lineIndexSize > 0) {
+        if (lineNumber < 0 || lineNumber >= lineIndexSize) {
+            return -1;
         }
+        return lineIndexTable[lineNumber];
     }
 
-    // Add the new line
-    if (numLines < MAX_NUM_LINES) {
-        program[numLines++] = *newLine;
+    bool found;
+    int index = findLinePosition(lineNumber, &found);
+    return found ? index : -1;
+}
 
-        // Sort lines by line number (simple bubble sort for now)
-        for (int i = 0; i < numLines - 1; i++) {
-            for (int j = 0; j < numLines - i - 1; j++) {
-                if (program[j].lineNumber > program[j + 1].lineNumber) {
-                    Line temp = program[j];
-                    program[j] = program[j + 1];
-                    program[j + 1] = temp;
-                }
-            }
+// Resolve the line number in a GOTO/GOSUB target token to a program index.
+// The result is cached on the token until the program is next edited.
+int resolveJumpTarget(Token *token) {
+    if (token->targetGeneration != programGeneration) {
+        token->target = token->isInteger ? findLineIndex(token->integer) : -1;
+        token->targetGeneration = programGeneration;
+    }
+    return token->target;
+}
+
+// Make room for at least one more line pointer
+static bool growProgram() {
+    if (numLines < programCapacity) {
+        return true;
+    }
+    int newCapacity = programCapacity ? programCapacity * 2 : 64;
+    Line **newProgram = realloc(program, newCapacity * sizeof(Line *));
+    if (!newProgram) {
+        perror("realloc");
+        return false;
+    }
+    program = newProgram;
+    programCapacity = newCapacity;
+    return true;
+}
+
+// Add a new line to the program or replace an existing line.
+// A line number with no statements deletes that line, as in Commodore BASIC.
+void addLine(Line *newLine) {
+    bool found;
+    int index = findLinePosition(newLine->lineNumber, &found);
+
+    programGeneration++; // Invalidate the line index and cached jump targets
+
+    if (newLine->numTokens == 0) {
+        if (found) {
+            deleteLine(index);
+        }
+        freeLine(newLine);
+        return;
+    }
+
+    if (found) {
+        // Replace the existing line
+        freeLine(program[index]);
+        *program[index] = *newLine;
+        return;
+    }
+
+    Line *line = malloc(sizeof(Line));
+    if (!line || !growProgram()) {
+        if (!line) {
+            perror("malloc");
+        }
+        free(line);
+        outPrintf("Program too large\n");
+        freeLine(newLine);
+        return;
+    }
+    *line = *newLine;
+    stats.allocations++;
+    stats.linesInserted++;
+
+    // Shift the later line pointers up and insert in sorted position
+    memmove(&program[index + 1], &program[index], (numLines - index) * sizeof(Line *));
+    program[index] = line;
+    numLines++;
+}
+
+// Bulk loading: lines are appended unsorted and put in order once by
+// finishAppend(), instead of a binary search and memmove per line.
+static int appendFrom = -1; // Index of the first appended line, -1 when not appending
+static bool appendInOrder = true; // Every appended line numbered above the one before
+
+// Append a line to the end of the program. Nothing may look at the program
+// until finishAppend() has been called.
+void appendLine(Line *newLine) {
+    Line *line = malloc(sizeof(Line));
+    if (!line || !growProgram()) {
+        if (!line) {
+            perror("malloc");
         }
-    } else {
-        printf("Program too large\n");
+        free(line);
+        outPrintf("Program too large\n");
+        freeLine(newLine);
+        return;
+    }
+    *line = *newLine;
+    stats.allocations++;
+    stats.linesInserted++;
+
+    if (appendFrom == -1) {
+        appendFrom = numLines;
+        appendInOrder = true;
     }
+    if (numLines > 0 && program[numLines - 1]->lineNumber >= line->lineNumber) {
+        appendInOrder = false;
+    }
+    program[numLines++] = line;
+}
+
+// Order appended lines by number, and by position for the same number
+typedef struct {
+    Line *line;
+    int position;
+} SortEntry;
+
+static int compareSortEntries(const void *a, const void *b) {
+    const SortEntry *x = a;
+    const SortEntry *y = b;
+    if (x->line->lineNumber != y->line->lineNumber) {
+        return x->line->lineNumber < y->line->lineNumber ? -1 : 1;
+    }
+    return x->position - y->position;
+}
+
+// Put appended lines in order. As with addLine, a later line replaces an
+// earlier one with the same number, and a number on its own deletes it.
+void finishAppend() {
+    if (appendFrom == -1) {
+        return;
+    }
+    programGeneration++;
+
+    if (!appendInOrder) {
+        // Sort the whole program once; the lines before appendFrom are
+        // already in order, but one pass over everything is simplest
+        SortEntry *entries = malloc(numLines * sizeof(SortEntry));
+        if (!entries) {
+            perror("malloc");
+            exit(1);
+        }
+        for (int i = 0; i < numLines; i++) {
+            entries[i].line = program[i];
+            entries[i].position = i;
+        }
+        qsort(entries, numLines, sizeof(SortEntry), compareSortEntries);
+        for (int i = 0; i < numLines; i++) {
+            program[i] = entries[i].line;
+        }
+        free(entries);
+    }
+
+    // Keep the last line of each number, dropping empty (deleting) lines
+    int kept = 0;
+    for (int i = 0; i < numLines; i++) {
+        Line *line = program[i];
+        bool replaced = i + 1 < numLines && program[i + 1]->lineNumber == line->lineNumber;
+        if (replaced || line->numTokens == 0) {
+            freeLine(line);
+            free(line);
+            continue;
+        }
+        program[kept++] = line;
+    }
+    numLines = kept;
+    appendFrom = -1;
+}
+
+// Remove the line at a given index from the program
+void deleteLine(int index) {
+    programGeneration++;
+    freeLine(program[index]);
+    free(program[index]);
+    memmove(&program[index], &program[index + 1], (numLines - index - 1) * sizeof(Line *));
+    numLines--;
 }
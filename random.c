@@ -0,0 +1,59 @@
+#include "cbsh.h"
+
+// RND, backed by xoshiro256** (Blackman and Vigna): four 64-bit words of
+// state, a few shifts and rotates per number, and a period of 2^256 - 1.
+// The generator starts from a fixed seed, so a program that never reseeds
+// gets the same numbers on every run.
+//
+//   RND(X > 0)  the next number in [0, 1)
+//   RND(X < 0)  reseed from X, then the first number of that sequence
+//   RND(0)      the last number again
+
+static uint64_t randomState[4];
+static double lastRandom = 0;
+static bool randomSeeded = false;
+
+static inline uint64_t rotateLeft(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+// Next 64 random bits
+static uint64_t nextRandom() {
+    uint64_t *s = randomState;
+    uint64_t result = rotateLeft(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotateLeft(s[3], 45);
+    return result;
+}
+
+// Fill the state from one seed with splitmix64, which never yields all zeros
+static void seedRandom(uint64_t seed) {
+    for (int i = 0; i < 4; i++) {
+        uint64_t z = (seed += 0x9e3779b97f4a7c15u);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9u;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebu;
+        randomState[i] = z ^ (z >> 31);
+    }
+    randomSeeded = true;
+}
+
+// RND(x)
+double randomNumber(double x) {
+    if (x == 0 && randomSeeded) {
+        return lastRandom;
+    }
+    if (x < 0) {
+        uint64_t bits;
+        memcpy(&bits, &x, sizeof(bits)); // Every distinct X gives its own sequence
+        seedRandom(bits);
+    } else if (!randomSeeded) {
+        seedRandom(0);
+    }
+    lastRandom = (nextRandom() >> 11) * 0x1.0p-53; // 53 random bits, exactly representable
+    return lastRandom;
+}
@@ -0,0 +1,139 @@
+#include "cbsh.h"
+
+// Script loading. The file is mapped into memory and tokenized line by line
+// straight out of the mapping in a single pass; numbered lines are appended
+// to the program and put in order once at the end (usually a no-op, since
+// scripts are normally written in order). Lines have no length limit.
+//
+// The tokenized program is cached as a binary image next to the script
+// (script.bas -> script.bas.cbc), keyed by a hash of the script's text and
+// the cbsh version, and later runs load that instead of lexing. Scripts with
+// unnumbered lines are not cached, since those run while the script loads.
+// Setting CBSH_NO_IMAGE_CACHE turns the cache off.
+
+// Tokenize one line of a script: run it now if it has no line number,
+// otherwise append it to the program. Returns true if it ran.
+static bool loadScriptLine(const char *text) {
+    Line newLine;
+    tokenizeLine(text, &newLine);
+    if (newLine.lineNumber != 0) {
+        appendLine(&newLine);
+        return false;
+    }
+    bool ran = newLine.numTokens > 0;
+    if (ran) {
+        finishAppend(); // The statement may look at the program
+        executeLine(&newLine);
+    }
+    freeLine(&newLine);
+    return ran;
+}
+
+// Load the cached image of a script, if there is one built from this text
+static bool loadCachedImage(const char *cachePath, uint64_t sourceHash) {
+    int fd = open(cachePath, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    bool loaded = false;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        char *image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (image != MAP_FAILED) {
+            loaded = loadImage(image, st.st_size, true, sourceHash);
+            munmap(image, st.st_size);
+        }
+    }
+    close(fd);
+    return loaded;
+}
+
+// Load a script file into the program, running its unnumbered lines as they
+// are reached. A first line starting with #! is skipped.
+bool loadScript(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        outPrintf("Error opening file: %s\n", path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("fstat");
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    if (size == 0) {
+        close(fd);
+        return true;
+    }
+    char *text = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (text == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+    madvise(text, size, MADV_SEQUENTIAL);
+
+    // A SAVEd image runs directly
+    if (isImage(text, size)) {
+        bool loaded = loadImage(text, size, false, 0);
+        if (!loaded) {
+            outPrintf("Invalid or incompatible program image: %s\n", path);
+        }
+        munmap(text, size);
+        return loaded;
+    }
+
+    bool useCache = getenv("CBSH_NO_IMAGE_CACHE") == NULL;
+    uint64_t sourceHash = 0;
+    char *cachePath = NULL;
+    if (useCache) {
+        sourceHash = hashSource(text, size);
+        cachePath = malloc(strlen(path) + 5);
+        if (!cachePath) {
+            perror("malloc");
+            exit(1);
+        }
+        sprintf(cachePath, "%s.cbc", path);
+        if (loadCachedImage(cachePath, sourceHash)) {
+            free(cachePath);
+            munmap(text, size);
+            return true;
+        }
+    }
+
+    bool ranLines = false;
+    const char *pos = text;
+    const char *end = text + size;
+    if (size >= 2 && pos[0] == '#' && pos[1] == '!') {
+        const char *eol = memchr(pos, '\n', end - pos);
+        pos = eol ? eol + 1 : end;
+    }
+
+    // The tokenizer stops at a newline, so lines are read in place; only a
+    // last line without one needs copying to get a terminator
+    while (pos < end) {
+        const char *eol = memchr(pos, '\n', end - pos);
+        if (eol) {
+            ranLines |= loadScriptLine(pos);
+            pos = eol + 1;
+        } else {
+            char *last = strndup(pos, end - pos);
+            if (!last) {
+                perror("strndup");
+                break;
+            }
+            ranLines |= loadScriptLine(last);
+            free(last);
+            pos = end;
+        }
+    }
+    finishAppend();
+    munmap(text, size);
+    if (useCache && !ranLines) {
+        saveImage(cachePath, sourceHash, false);
+    }
+    free(cachePath);
+    return true;
+}
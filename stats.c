@@ -0,0 +1,82 @@
+#include "cbsh.h"
+
+// Runtime counters, for finding out what a slow or greedy script is doing
+// without a debugger. Most counters are bumped on paths that are cold once
+// a program runs (lexing, inserting lines, resolving names to slots) and are
+// always kept. Counting statements would cost the VM an increment per
+// statement, so it only happens while SET STATS = TRUE (or a profile runs).
+//
+// STATS prints the counters. With CBSH_STATS set, they are also written as
+// one JSON object when cbsh exits: to stderr for "1" or "-", otherwise to
+// the file it names.
+
+Stats stats;
+bool statsEnabled = false; // SET STATS: count statements
+
+// A statement is starting while statements are being counted or profiled
+void countStatement(int line, int statement) {
+    stats.statements++;
+    if (profiling) {
+        profileStatement(line, statement);
+    }
+}
+
+// Largest resident set size so far, in kilobytes
+static long peakRssKb() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    return usage.ru_maxrss;
+}
+
+// Execute STATS command
+void executeStats() {
+    outFlush(); // So bytesPrinted includes everything before this
+    double averageProbe = stats.variableLookups ? (double)stats.variableProbes / stats.variableLookups : 0;
+    outPrintf("Statements executed  %llu%s\n", (unsigned long long)stats.statements,
+              statsEnabled ? "" : " (counted while SET STATS = TRUE)");
+    outPrintf("Variable lookups     %llu (%.2f probes on average, longest %llu)\n",
+              (unsigned long long)stats.variableLookups, averageProbe, (unsigned long long)stats.longestProbe);
+    outPrintf("Lines lexed          %llu (%llu tokens)\n", (unsigned long long)stats.linesLexed,
+              (unsigned long long)stats.tokensLexed);
+    outPrintf("Lines inserted       %llu\n", (unsigned long long)stats.linesInserted);
+    outPrintf("GOSUB depth reached  %llu\n", (unsigned long long)stats.gosubHighWater);
+    outPrintf("DATA items read      %llu\n", (unsigned long long)stats.dataReads);
+    outPrintf("Bytes printed        %llu\n", (unsigned long long)stats.bytesPrinted);
+    outPrintf("Allocations          %llu\n", (unsigned long long)stats.allocations);
+    outPrintf("Peak RSS             %ld KB\n", peakRssKb());
+}
+
+// Write the counters as JSON (CBSH_STATS), at exit
+static void dumpStats() {
+    const char *target = getenv("CBSH_STATS");
+    outFlush();
+    bool toStderr = strcmp(target, "1") == 0 || strcmp(target, "-") == 0 || target[0] == '\0';
+    FILE *file = toStderr ? stderr : fopen(target, "w");
+    if (!file) {
+        fprintf(stderr, "Cannot write stats to %s: %s\n", target, strerror(errno));
+        return;
+    }
+    fprintf(file,
+            "{\"statements\": %llu, \"variable_lookups\": %llu, \"variable_probes\": %llu, \"longest_probe\": %llu, "
+            "\"lines_lexed\": %llu, \"tokens_lexed\": %llu, \"lines_inserted\": %llu, \"gosub_high_water\": %llu, "
+            "\"data_reads\": %llu, \"bytes_printed\": %llu, \"allocations\": %llu, \"peak_rss_kb\": %ld}\n",
+            (unsigned long long)stats.statements, (unsigned long long)stats.variableLookups,
+            (unsigned long long)stats.variableProbes, (unsigned long long)stats.longestProbe,
+            (unsigned long long)stats.linesLexed, (unsigned long long)stats.tokensLexed,
+            (unsigned long long)stats.linesInserted, (unsigned long long)stats.gosubHighWater,
+            (unsigned long long)stats.dataReads, (unsigned long long)stats.bytesPrinted,
+            (unsigned long long)stats.allocations, peakRssKb());
+    if (!toStderr) {
+        fclose(file);
+    }
+}
+
+// Arrange the JSON dump at exit if CBSH_STATS asks for it (which also turns on statement counting)
+void initStats() {
+    if (getenv("CBSH_STATS")) {
+        statsEnabled = true;
+        atexit(dumpStats);
+    }
+}
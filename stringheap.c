@@ -0,0 +1,191 @@
+#include "cbsh.h"
+
+// String heap. A String is a length and its bytes (not NUL-terminated).
+// Strings of up to SMALL_STRING bytes are stored inline; longer ones are a
+// slice of a reference-counted StringBuffer, or point straight at interned
+// text (literals and DATA items), which lives until NEW resets the pool.
+// Slices (LEFT$, MID$, ...) share their source's storage instead of copying,
+// and concatenation appends in place when the left operand ends where its
+// buffer's used bytes end, growing buffers geometrically, so building a
+// string piece by piece in a loop takes linear time.
+
+struct StringBuffer {
+    int refs;
+    int length; // Bytes in use; an append goes after them
+    int capacity;
+    char data[];
+};
+
+#define MAX_STRING_LENGTH (INT_MAX / 2)
+
+// A new buffer with room for capacity bytes, holding one reference
+static StringBuffer *newStringBuffer(int capacity) {
+    StringBuffer *buffer = malloc(sizeof(StringBuffer) + capacity);
+    if (!buffer) {
+        perror("malloc");
+        exit(1);
+    }
+    stats.allocations++;
+    buffer->refs = 1;
+    buffer->length = 0;
+    buffer->capacity = capacity;
+    return buffer;
+}
+
+// A string of text that outlives it (interned): inline if short, else a pointer to it
+String stringLiteral(const char *text, int length) {
+    String s;
+    s.length = length;
+    s.buffer = NULL;
+    if (length <= SMALL_STRING) {
+        memcpy(s.data.inlined, text, length);
+    } else {
+        s.data.chars = text;
+    }
+    return s;
+}
+
+// A string holding its own copy of some bytes
+String stringCopy(const char *text, int length) {
+    if (length <= SMALL_STRING) {
+        return stringLiteral(text, length);
+    }
+    StringBuffer *buffer = newStringBuffer(length);
+    memcpy(buffer->data, text, length);
+    buffer->length = length;
+    String s;
+    s.length = length;
+    s.buffer = buffer;
+    s.data.chars = buffer->data;
+    return s;
+}
+
+// Take another reference to a string's buffer, if it has one
+void stringRetain(String *s) {
+    if (s->buffer) {
+        s->buffer->refs++;
+    }
+}
+
+// Drop a reference to a string's buffer; the string becomes empty
+void stringRelease(String *s) {
+    if (s->buffer && --s->buffer->refs == 0) {
+        free(s->buffer);
+    }
+    s->length = 0;
+    s->buffer = NULL;
+}
+
+// Store a string in a variable or array element. An owned string's
+// reference moves into it; a borrowed one gets a reference of its own. A
+// short slice is copied inline so it does not keep a large buffer alive.
+void stringAssign(String *dest, String *value, bool owned) {
+    String stored = *value;
+    if (stored.buffer && stored.length <= SMALL_STRING) {
+        stored = stringLiteral(stringChars(value), value->length);
+        if (owned) {
+            stringRelease(value);
+        }
+    } else if (!owned) {
+        stringRetain(&stored);
+    }
+    String old = *dest;
+    *dest = stored;
+    stringRelease(&old);
+}
+
+// Bytes start .. start + length of a string, sharing its storage. The
+// range must lie within the string. A slice of an owned string owns the
+// same reference.
+String stringSlice(const String *s, int start, int length) {
+    if (s->buffer) {
+        String slice = *s;
+        slice.data.chars += start;
+        slice.length = length;
+        return slice;
+    }
+    return stringLiteral(stringChars(s) + start, length);
+}
+
+// a + b, into *result (which is owned). Returns false (after reporting) if
+// it would be too long; an owned a is consumed either way.
+bool stringConcat(String *result, String *a, bool ownsA, const String *b) {
+    if (a->length > MAX_STRING_LENGTH - b->length) {
+        outPrintf("String too long\n");
+        if (ownsA) {
+            stringRelease(a);
+        }
+        return false;
+    }
+    int length = a->length + b->length;
+
+    if (length <= SMALL_STRING) {
+        String s;
+        s.length = length;
+        s.buffer = NULL;
+        memcpy(s.data.inlined, stringChars(a), a->length);
+        memcpy(s.data.inlined + a->length, stringChars(b), b->length);
+        if (ownsA) {
+            stringRelease(a);
+        }
+        *result = s;
+        return true;
+    }
+
+    // Append in place: nobody else can see the bytes after the buffer's used length
+    StringBuffer *buffer = a->buffer;
+    if (buffer && a->data.chars + a->length == buffer->data + buffer->length &&
+        b->length <= buffer->capacity - buffer->length) {
+        memcpy(buffer->data + buffer->length, stringChars(b), b->length);
+        buffer->length += b->length;
+        if (!ownsA) {
+            buffer->refs++;
+        }
+        *result = *a;
+        result->length = length;
+        return true;
+    }
+
+    int capacity = length < MAX_STRING_LENGTH / 2 ? length * 2 : MAX_STRING_LENGTH;
+    StringBuffer *fresh = newStringBuffer(capacity < 64 ? 64 : capacity);
+    memcpy(fresh->data, stringChars(a), a->length);
+    memcpy(fresh->data + a->length, stringChars(b), b->length);
+    fresh->length = length;
+    if (ownsA) {
+        stringRelease(a);
+    }
+    result->length = length;
+    result->buffer = fresh;
+    result->data.chars = fresh->data;
+    return true;
+}
+
+// Compare two strings byte by byte: <0, 0 or >0
+int stringCompare(const String *a, const String *b) {
+    int shorter = a->length < b->length ? a->length : b->length;
+    int cmp = memcmp(stringChars(a), stringChars(b), shorter);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return (a->length > b->length) - (a->length < b->length);
+}
+
+// Position (0-based) of the first match of pattern in s at or after start, or -1
+int stringFind(const String *s, const String *pattern, int start) {
+    const char *text = stringChars(s);
+    const char *wanted = stringChars(pattern);
+    if (pattern->length == 0) {
+        return start <= s->length ? start : -1;
+    }
+    for (int i = start; i <= s->length - pattern->length; i++) {
+        const char *hit = memchr(text + i, wanted[0], s->length - pattern->length - i + 1);
+        if (!hit) {
+            return -1;
+        }
+        i = hit - text;
+        if (memcmp(hit, wanted, pattern->length) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,28 @@
+#!/bin/sh
+# Unquoted DATA items read back as written, however long they are
+
+CBSH=${CBSH:-./cbsh}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+item=WORD
+for i in $(seq 2 100); do
+    item="$item WORD$i"
+done
+cat > "$dir/prog.bas" <<BAS
+10 DATA $item, -5, "Q"
+20 READ A\$, B, C\$
+30 PRINT LEN(A\$); B; C\$
+40 PRINT A\$
+50 DATA x=1,a  b , "P, Q", &H10: PRINT "NEXT"
+60 READ A\$, B\$, C\$, D: PRINT "["; A\$; "]["; B\$; "]["; C\$; "]"; D
+BAS
+
+expected=$(printf ' %d -5 Q\n%s\nNEXT\n[x=1][a  b][P, Q] 16 ' "${#item}" "$item")
+actual=$(CBSH_NO_IMAGE_CACHE=1 "$CBSH" "$dir/prog.bas") || exit 1
+if [ "$actual" != "$expected" ]; then
+    echo "got: $actual"
+    echo "expected: $expected"
+    exit 1
+fi
+exit 0
@@ -0,0 +1,47 @@
+#!/bin/sh
+# A program using the newer keywords must survive SAVE and loading the image
+# back, and its script cache must be reused rather than rebuilt on every run.
+# Both fail if image.c's keyword bound falls behind the Keyword enum.
+
+CBSH=${CBSH:-./cbsh}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+cat > "$dir/prog.bas" <<'BAS'
+10 DIM A(3), B(3)
+20 FOR I = 0 TO 3: A(I) = I * I: NEXT I
+30 MAT B = A + A
+40 S$ = "HELLO WORLD"
+50 PRINT SUM(B); LEN(S$); MID$(S$, 7, 5); COS(0)
+60 WAIT
+70 IF ST = 99 THEN STATS
+80 PRINT "ST"; ST
+BAS
+
+expected=$(CBSH_NO_IMAGE_CACHE=1 "$CBSH" "$dir/prog.bas") || exit 1
+case "$expected" in
+    *WORLD*) ;;
+    *) echo "program did not run: $expected"; exit 1 ;;
+esac
+
+# SAVE an image and run it
+(cat "$dir/prog.bas"; echo "SAVE \"$dir/prog.prg\"") | "$CBSH" > /dev/null 2>&1
+actual=$("$CBSH" "$dir/prog.prg") || { echo "saved image was rejected"; exit 1; }
+if [ "$actual" != "$expected" ]; then
+    echo "saved image gave: $actual"
+    echo "expected: $expected"
+    exit 1
+fi
+
+# The first run writes the cache, the second must load it as it is
+actual=$("$CBSH" "$dir/prog.bas") || exit 1
+[ "$actual" = "$expected" ] || { echo "first cached run gave: $actual"; exit 1; }
+[ -f "$dir/prog.bas.cbc" ] || { echo "no cache written"; exit 1; }
+inode=$(ls -i "$dir/prog.bas.cbc" | cut -d' ' -f1)
+actual=$("$CBSH" "$dir/prog.bas") || exit 1
+[ "$actual" = "$expected" ] || { echo "second cached run gave: $actual"; exit 1; }
+if [ "$(ls -i "$dir/prog.bas.cbc" | cut -d' ' -f1)" != "$inode" ]; then
+    echo "cache was rejected and rewritten"
+    exit 1
+fi
+exit 0
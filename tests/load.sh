@@ -0,0 +1,27 @@
+#!/bin/sh
+# LOAD: exit status in ST, any number of arguments, background jobs
+
+CBSH=${CBSH:-./cbsh}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+words=$(for i in $(seq 300); do printf 'w%d ' "$i"; done)
+cat > "$dir/prog.bas" <<BAS
+10 LOAD "false": PRINT ST
+20 LOAD "sh", "$dir/count.sh $words"
+30 PRINT ST
+40 LOAD "sh", "$dir/count.sh a b c" &
+50 WAIT 1: PRINT ST
+60 LOAD ""
+70 PRINT ST
+BAS
+printf 'exit $#\n' > "$dir/count.sh"
+
+expected=$(printf ' 1 \n 44 \n[1] PID\n 3 \nInvalid LOAD statement: no command to run\n 127 ')
+actual=$(CBSH_NO_IMAGE_CACHE=1 "$CBSH" "$dir/prog.bas" | sed 's/^\[1\] [0-9]*$/[1] PID/') || exit 1
+if [ "$actual" != "$expected" ]; then
+    echo "got: $actual"
+    echo "expected: $expected"
+    exit 1
+fi
+exit 0
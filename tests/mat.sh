@@ -0,0 +1,48 @@
+#!/bin/sh
+# MAT with the result array also an operand (MAT A = A * B, MAT B = B * B,
+# MAT V = A * V) must give what a separate result array would, with every
+# set of vector kernels
+
+CBSH=${CBSH:-./cbsh}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+cat > "$dir/prog.bas" <<'BAS'
+10 DIM A(1, 1), B(1, 1), V(1)
+20 MAT READ A, B, V
+30 DATA 1, 2, 3, 4, 5, 6, 7, 8, 1, 1
+40 MAT C = A * B: MAT A = A * B
+50 MAT PRINT C: MAT PRINT A
+60 MAT B = B * B: MAT PRINT B
+70 MAT V = A * V: MAT PRINT V
+80 MAT A = A + A: MAT A = A - B: MAT A = (2) * A: MAT PRINT A
+90 PRINT SUM(A); DOT(V, V)
+BAS
+
+cat > "$dir/expected" <<'OUT'
+ 19  22 
+ 43  50 
+
+ 19  22 
+ 43  50 
+
+ 67  78 
+ 91  106 
+
+ 41  93 
+
+-58 -68 
+-10 -12 
+
+-148  10330 
+OUT
+
+for kernels in "" scalar sse2; do
+    CBSH_KERNELS=$kernels CBSH_NO_IMAGE_CACHE=1 "$CBSH" "$dir/prog.bas" > "$dir/actual" || exit 1
+    if ! cmp -s "$dir/actual" "$dir/expected"; then
+        echo "kernels ${kernels:-default}:"
+        diff "$dir/expected" "$dir/actual"
+        exit 1
+    fi
+done
+exit 0
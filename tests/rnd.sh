@@ -0,0 +1,38 @@
+#!/bin/sh
+# RND: numbers in [0, 1), RND(0) repeats the last one, RND(X < 0) reseeds
+# repeatably, and an unseeded program gets the same numbers on every run
+
+CBSH=${CBSH:-./cbsh}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+cat > "$dir/prog.bas" <<'BAS'
+10 BAD = 0: T = 0
+20 FOR I = 1 TO 1000: R = RND(1): T = T + R
+30 IF R < 0 OR R >= 1 THEN BAD = BAD + 1
+40 NEXT I
+50 PRINT "BAD"; BAD; "MEAN OK"; ABS(T / 1000 - .5) < .05
+60 R = RND(1): PRINT "REPEAT"; RND(0) = R; RND(0) = R
+70 X = RND(-7): A = RND(1): B = RND(1)
+80 Y = RND(-7): PRINT "RESEED"; X = Y; RND(1) = A; RND(1) = B
+90 Z = RND(-8): PRINT "OTHER SEED"; Z <> X
+BAS
+cat > "$dir/first.bas" <<'BAS'
+10 PRINT RND(1); RND(1)
+BAS
+
+expected=$(printf 'BAD 0 MEAN OK-1 \nREPEAT-1 -1 \nRESEED-1 -1 -1 \nOTHER SEED-1 ')
+actual=$(CBSH_NO_IMAGE_CACHE=1 "$CBSH" "$dir/prog.bas") || exit 1
+if [ "$actual" != "$expected" ]; then
+    echo "got: $actual"
+    echo "expected: $expected"
+    exit 1
+fi
+
+first=$(CBSH_NO_IMAGE_CACHE=1 "$CBSH" "$dir/first.bas") || exit 1
+second=$(CBSH_NO_IMAGE_CACHE=1 "$CBSH" "$dir/first.bas") || exit 1
+if [ "$first" != "$second" ]; then
+    echo "unseeded runs differ: $first / $second"
+    exit 1
+fi
+exit 0
@@ -0,0 +1,33 @@
+#!/bin/sh
+# String heap: slices share their source's text and appends reuse spare
+# room, but no string may ever see another one change
+
+CBSH=${CBSH:-./cbsh}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+cat > "$dir/prog.bas" <<'BAS'
+10 A$ = "THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG"
+20 B$ = A$: L$ = LEFT$(A$, 9): M$ = MID$(A$, 11, 5): R$ = RIGHT$(A$, 3)
+30 A$ = A$ + "!": B$ = B$ + "?": L$ = L$ + " CAT": M$ = M$ + "ISH"
+40 PRINT A$: PRINT B$: PRINT L$; "|"; M$; "|"; R$
+50 S$ = "": FOR I = 1 TO 500: S$ = S$ + "AB": NEXT I
+60 T$ = S$: S$ = S$ + "C": T$ = T$ + "D"
+70 PRINT LEN(S$); LEN(T$); RIGHT$(S$, 3); RIGHT$(T$, 3); MID$(S$, 999, 2)
+80 DIM X$(2): X$(1) = "SHORT": X$(2) = X$(1) + X$(1): X$(1) = X$(1) + "ER"
+90 PRINT X$(1); " "; X$(2); INSTR(A$, "FOX"); INSTR(20, A$, "THE")
+BAS
+
+expected=$(printf '%s\n%s\n%s\n%s\n%s' \
+    'THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG!' \
+    'THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG?' \
+    'THE QUICK CAT|BROWNISH|DOG' \
+    ' 1001  1001 ABCABDAB' \
+    'SHORTER SHORTSHORT 17  32 ')
+actual=$(CBSH_NO_IMAGE_CACHE=1 "$CBSH" "$dir/prog.bas") || exit 1
+if [ "$actual" != "$expected" ]; then
+    echo "got: $actual"
+    echo "expected: $expected"
+    exit 1
+fi
+exit 0
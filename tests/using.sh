@@ -0,0 +1,24 @@
+#!/bin/sh
+# PRINT USING with fields wider than any number they can hold
+
+CBSH=${CBSH:-./cbsh}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+zeros=$(printf '%080d' 0)
+hashes=$(printf '%080d' 0 | tr 0 '#')
+wide=$(printf '%040d' 0 | tr 0 '#')
+cat > "$dir/prog.bas" <<BAS
+10 PRINT USING "#.$hashes"; 0
+20 PRINT USING "$wide"; 12345
+30 PRINT USING "##,###,###.##"; 1234567.891
+BAS
+
+expected=$(printf '0.%s\n%40s\n 1,234,567.89' "$zeros" 12345)
+actual=$(CBSH_NO_IMAGE_CACHE=1 "$CBSH" "$dir/prog.bas") || exit 1
+if [ "$actual" != "$expected" ]; then
+    echo "got: $actual"
+    echo "expected: $expected"
+    exit 1
+fi
+exit 0
@@ -0,0 +1,40 @@
+#!/bin/sh
+# The bytecode VM, its counting dispatch (SET STATS) and the line-by-line
+# interpreter must run a program identically, and END must flush output
+# before anything that runs after it
+
+CBSH=${CBSH:-./cbsh}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+cat > "$dir/prog.bas" <<'BAS'
+10 DIM A(5), N%(3)
+20 FOR I = 1 TO 5: A(I) = I * I: NEXT I
+30 T = 0: FOR I = 5 TO 1 STEP -2: T = T + A(I): NEXT I
+40 GOSUB 200: GOSUB 200
+50 N%(1) = 7.9: S$ = "AB" + "CD"
+60 IF T > 30 THEN PRINT "BIG";: GOTO 80
+70 PRINT "SMALL";
+80 PRINT T; C; N%(1); S$
+90 ON 2 GOSUB 200, 300
+100 PRINT "END"
+110 END
+200 C = C + 1: RETURN
+300 PRINT "THREE": RETURN
+BAS
+
+# Run the program in direct mode after the given SET, keeping only its output
+run() {
+    (cat "$dir/prog.bas"; echo "$1"; echo "RUN"; echo 'LOAD "echo", "AFTER"') | "$CBSH" 2>&1 | sed '1,3d' | grep -v '^cbsh>' | grep -v ' set to '
+}
+
+expected=$(printf 'BIG 35  2  7 ABCD\nTHREE\nEND\nAFTER')
+for setting in "SET BYTECODE = TRUE" "SET BYTECODE = FALSE" "SET STATS = TRUE"; do
+    actual=$(run "$setting")
+    if [ "$actual" != "$expected" ]; then
+        echo "$setting gave: $actual"
+        echo "expected: $expected"
+        exit 1
+    fi
+done
+exit 0
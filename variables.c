@@ -1,91 +1,370 @@
 #include "cbsh.h"
 
-// Find a variable by name (case-insensitive)
-Variable *findVariable(const char *name) {
-    for (int i = 0; i < numVariables; i++) {
-        if (strcasecmp(variables[i].name, name) == 0) {
-            return &variables[i];
+// Symbol table, stored as parallel arrays indexed by slot: the values the
+// hot paths load (numValues, intValues, strValues) are dense arrays of their
+// own, and names, types and arrays sit apart in variableInfo. Slots are
+// found through an open-addressing hash keyed on the interned, upper-cased
+// name; because names are interned, two names are equal exactly when their
+// pointers are equal. A slot never changes until the table is reset, so
+// tokens can be resolved to a slot once and then read with a single load.
+// Arrays are entered under "NAME(", so A and A() are different variables;
+// their elements live in one contiguous block owned by the array's entry.
+// A name ending in $ is a string variable, one ending in % an integer one.
+//
+// Resetting is O(1): hash entries carry the generation they were made in,
+// so bumping the generation empties the hash, and the strings and arrays
+// left in old slots are released when a slot is handed out again.
+
+typedef struct {
+    int slot;
+    unsigned int generation; // Empty unless this is indexGeneration
+} IndexEntry;
+
+static IndexEntry *variableIndex = NULL;
+static int variableIndexCapacity = 0; // Always a power of two
+static unsigned int indexGeneration = 1;
+static int usedSlots = 0; // Slots that have held a variable since startup
+
+// Intern the case-folded form of a variable name, with "(" added for an array
+static const char *foldName(const char *name, bool isArray) {
+    static char *buffer = NULL;
+    static size_t bufferSize = 0;
+    size_t len = strlen(name);
+    if (len + 2 > bufferSize) {
+        char *newBuffer = realloc(buffer, len + 2);
+        if (!newBuffer) {
+            perror("realloc");
+            exit(1);
+        }
+        buffer = newBuffer;
+        bufferSize = len + 2;
+    }
+    for (size_t i = 0; i < len; i++) {
+        buffer[i] = toupper((unsigned char)name[i]);
+    }
+    if (isArray) {
+        buffer[len++] = '(';
+    }
+    return internString(buffer, len);
+}
+
+// Hash an interned name by its address
+static unsigned int hashName(const char *foldedName) {
+    uintptr_t bits = (uintptr_t)foldedName;
+    return (unsigned int)((bits >> 3) * 2654435761u);
+}
+
+// Find the hash table position holding foldedName, or the empty one it would go in
+static int probeVariable(const char *foldedName) {
+    int mask = variableIndexCapacity - 1;
+    int pos = hashName(foldedName) & mask;
+    unsigned int probes = 1;
+    while (variableIndex[pos].generation == indexGeneration &&
+           variableInfo[variableIndex[pos].slot].name != foldedName) {
+        pos = (pos + 1) & mask;
+        probes++;
+    }
+    stats.variableLookups++;
+    stats.variableProbes += probes;
+    if (probes > stats.longestProbe) {
+        stats.longestProbe = probes;
+    }
+    return pos;
+}
+
+// Grow one of the parallel symbol table arrays
+static void *growArray(void *array, int capacity, size_t elementSize) {
+    void *newArray = realloc(array, capacity * elementSize);
+    if (!newArray) {
+        perror("realloc");
+        exit(1);
+    }
+    return newArray;
+}
+
+// Double the hash table (and variable arrays if needed) and rehash
+static void growVariables() {
+    if (numVariables == variablesCapacity) {
+        int newCapacity = variablesCapacity ? variablesCapacity * 2 : 64;
+        numValues = growArray(numValues, newCapacity, sizeof(double));
+        intValues = growArray(intValues, newCapacity, sizeof(int64_t));
+        strValues = growArray(strValues, newCapacity, sizeof(String));
+        variableInfo = growArray(variableInfo, newCapacity, sizeof(VariableInfo));
+        variablesCapacity = newCapacity;
+    }
+
+    if ((numVariables + 1) * 2 > variableIndexCapacity) {
+        int newCapacity = variableIndexCapacity ? variableIndexCapacity * 2 : 128;
+        IndexEntry *newIndex = calloc(newCapacity, sizeof(IndexEntry));
+        if (!newIndex) {
+            perror("calloc");
+            exit(1);
+        }
+        free(variableIndex);
+        variableIndex = newIndex;
+        variableIndexCapacity = newCapacity;
+        for (int slot = 0; slot < numVariables; slot++) {
+            IndexEntry *entry = &variableIndex[probeVariable(variableInfo[slot].name)];
+            entry->slot = slot;
+            entry->generation = indexGeneration;
+        }
+    }
+}
+
+// Free the elements of an array
+static void freeArray(Array *array) {
+    if (array) {
+        free(array->numbers);
+        free(array->integers);
+        if (array->strings) {
+            for (int i = 0; i < array->size; i++) {
+                stringRelease(&array->strings[i]);
+            }
+            free(array->strings);
+        }
+        free(array);
+    }
+}
+
+// Find the slot of a variable by name (case-insensitive), or -1
+int findVariableSlot(const char *name) {
+    if (numVariables == 0) {
+        return -1;
+    }
+    IndexEntry *entry = &variableIndex[probeVariable(foldName(name, false))];
+    return entry->generation == indexGeneration ? entry->slot : -1;
+}
+
+// Find the slot of a folded name, creating it (zeroed) if it does not exist.
+// The type comes from the name: a $ makes a string variable, a % an integer one.
+static int foldedNameSlot(const char *foldedName) {
+    if (numVariables > 0) {
+        IndexEntry *entry = &variableIndex[probeVariable(foldedName)];
+        if (entry->generation == indexGeneration) {
+            return entry->slot;
+        }
+    }
+
+    growVariables();
+    int slot = numVariables++;
+    if (slot < usedSlots) {
+        // Left over from before the last reset
+        stringRelease(&strValues[slot]);
+        freeArray(variableInfo[slot].array);
+    } else {
+        usedSlots++;
+    }
+    numValues[slot] = 0;
+    intValues[slot] = 0;
+    memset(&strValues[slot], 0, sizeof(String));
+    VariableInfo *info = &variableInfo[slot];
+    info->name = foldedName;
+    info->type = strchr(foldedName, '$')   ? VAR_TYPE_STRING
+                 : strchr(foldedName, '%') ? VAR_TYPE_INTEGER
+                                           : VAR_TYPE_NUMERIC;
+    info->array = NULL;
+    IndexEntry *entry = &variableIndex[probeVariable(foldedName)];
+    entry->slot = slot;
+    entry->generation = indexGeneration;
+    return slot;
+}
+
+// Find the slot of a variable by name, creating it if it does not exist
+int getVariableSlot(const char *name) {
+    return foldedNameSlot(foldName(name, false));
+}
+
+// Find the slot of an array by name, creating it (not yet dimensioned) if needed
+int getArraySlot(const char *name) {
+    return foldedNameSlot(foldName(name, true));
+}
+
+// Length of an array's name without the "(" that keeps it apart from scalars
+static int arrayNameLength(int slot) {
+    return (int)strlen(variableInfo[slot].name) - 1;
+}
+
+// Give an array variable fresh, zeroed elements of the given shape. Returns
+// NULL (after reporting) if it is too large.
+Array *dimensionArray(int slot, int numDims, const int *extents) {
+    VariableInfo *info = &variableInfo[slot];
+    size_t size = 1;
+    for (int i = 0; i < numDims; i++) {
+        if (extents[i] <= 0 || size > (size_t)INT_MAX / extents[i]) {
+            outPrintf("Array too large: %.*s\n", arrayNameLength(slot), info->name);
+            return NULL;
+        }
+        size *= extents[i];
+    }
+
+    Array *array = calloc(1, sizeof(Array));
+    if (!array) {
+        perror("calloc");
+        exit(1);
+    }
+    stats.allocations += 2; // The array and its elements
+    if (info->type == VAR_TYPE_NUMERIC) {
+        array->numbers = calloc(size, sizeof(double));
+    } else if (info->type == VAR_TYPE_INTEGER) {
+        array->integers = calloc(size, sizeof(int64_t));
+    } else {
+        array->strings = calloc(size, sizeof(String)); // All empty
+    }
+    if (!array->numbers && !array->integers && !array->strings) {
+        outPrintf("Out of memory for array %.*s\n", arrayNameLength(slot), info->name);
+        free(array);
+        return NULL;
+    }
+    array->numDims = numDims;
+    memcpy(array->extents, extents, numDims * sizeof(int));
+    array->size = (int)size;
+    freeArray(info->array);
+    info->array = array;
+    return array;
+}
+
+// Address of an array element from its subscripts. An array used before DIM
+// gets subscripts 0..10 in each dimension. Returns false (after reporting)
+// for a subscript out of range.
+bool elementAddress(int slot, Value *subscripts, int count, Target *target) {
+    VariableInfo *info = &variableInfo[slot];
+    Array *array = info->array;
+    if (!array) {
+        int extents[MAX_DIMENSIONS];
+        for (int i = 0; i < count; i++) {
+            extents[i] = 11;
+        }
+        array = dimensionArray(slot, count, extents);
+        if (!array) {
+            return false;
+        }
+    }
+    if (count != array->numDims) {
+        outPrintf("Bad subscript: %.*s has %d dimension(s)\n", arrayNameLength(slot), info->name, array->numDims);
+        return false;
+    }
+
+    int offset = 0;
+    for (int i = 0; i < count; i++) {
+        double index = subscripts[i].num;
+        if (subscripts[i].type != VAR_TYPE_NUMERIC) {
+            outPrintf("Type mismatch\n");
+            return false;
+        }
+        if (!(index >= 0 && index < array->extents[i])) { // Also rejects NaN
+            outPrintf("Bad subscript: %.*s(%g)\n", arrayNameLength(slot), info->name, index);
+            return false;
+        }
+        offset = offset * array->extents[i] + (int)index;
+    }
+
+    target->type = info->type;
+    target->num = array->numbers ? &array->numbers[offset] : NULL;
+    target->integer = array->integers ? &array->integers[offset] : NULL;
+    target->str = array->strings ? &array->strings[offset] : NULL;
+    return true;
+}
+
+// Storage of a scalar variable
+void variableTarget(int slot, Target *target) {
+    target->type = variableInfo[slot].type;
+    target->num = &numValues[slot];
+    target->integer = &intValues[slot];
+    target->str = &strValues[slot];
+}
+
+// Assign a value to a variable or array element of the same type (numbers
+// go into integer targets rounded down, as INT does). The value's
+// reference, if it owns one, is used up.
+void storeValue(Target *target, Value *value) {
+    if ((value->type == VAR_TYPE_STRING) != (target->type == VAR_TYPE_STRING)) {
+        outPrintf("Type mismatch\n");
+        releaseValue(value);
+    } else if (target->type == VAR_TYPE_NUMERIC) {
+        *target->num = value->num;
+    } else if (target->type == VAR_TYPE_INTEGER) {
+        double whole = floor(value->num);
+        if (!(whole >= -0x1p63 && whole < 0x1p63)) { // Also rejects NaN
+            outPrintf("Illegal quantity: %g\n", value->num);
+            return;
         }
+        *target->integer = (int64_t)whole;
+    } else {
+        stringAssign(target->str, &value->str, value->owned);
     }
-    return NULL;
+}
+
+// Slot an identifier token refers to, using its resolved slot when it has one; -1 if none
+int tokenSlot(Token *token) {
+    if (token->slot >= 0) {
+        return token->slot;
+    }
+    return findVariableSlot(token->value);
+}
+
+// Slot of the variable an identifier token assigns to, creating it if needed
+int assignableSlot(Token *token) {
+    if (token->slot < 0) {
+        return getVariableSlot(token->value);
+    }
+    return token->slot;
+}
+
+// Resolve every identifier in a line to its variable slot (an array's when
+// a subscript follows)
+void resolveLineSlots(Line *line) {
+    for (int i = 0; i < line->numTokens; i++) {
+        Token *token = &line->tokens[i];
+        if (token->type != TOKEN_IDENTIFIER) {
+            continue;
+        }
+        bool isArray = i + 1 < line->numTokens && token[1].type == TOKEN_OPERATOR && strcmp(token[1].value, "(") == 0;
+        token->slot = isArray ? getArraySlot(token->value) : getVariableSlot(token->value);
+    }
+}
+
+// Forget all variables (the slots resolved into tokens become invalid)
+void resetVariables() {
+    numVariables = 0;
+    indexGeneration++;
+    symbolGeneration++;
 }
 
 // Get the value of a variable (or literal)
 double getNumericValue(Token *token) {
     if (token->type == TOKEN_NUMBER) {
-        return atof(token->value);
+        return token->number;
     } else if (token->type == TOKEN_IDENTIFIER) {
-        Variable *var = findVariable(token->value);
-        if (var == NULL) {
-            printf("Undefined variable: %s\n", token->value);
+        int slot = tokenSlot(token);
+        if (slot == -1) {
+            outPrintf("Undefined variable: %s\n", token->value);
             return 0; // Or handle the error appropriately
         }
-        if (var->type != VAR_TYPE_NUMERIC) {
-            printf("Type mismatch: %s is not a numeric variable\n", token->value);
+        if (variableInfo[slot].type == VAR_TYPE_INTEGER) {
+            return (double)intValues[slot];
+        }
+        if (variableInfo[slot].type != VAR_TYPE_NUMERIC) {
+            outPrintf("Type mismatch: %s is not a numeric variable\n", token->value);
             return 0;
         }
-        return var->numValue;
+        return numValues[slot];
     }
-    printf("Invalid numeric value\n");
+    outPrintf("Invalid numeric value\n");
     return 0;
 }
 
-// Get string value
-char *getStringValue(Token *token) {
-    if (token->type == TOKEN_STRING) {
-        return token->value; // Directly return the string literal
-    } else if (token->type == TOKEN_IDENTIFIER) {
-        Variable *var = findVariable(token->value);
-        if (var) {
-            if (var->type == VAR_TYPE_STRING) {
-                return var->strValue;
-            } else {
-                printf("Type mismatch: %s is not a string variable\n", token->value);
-                return ""; // Handle error: not a string variable
-            }
-        } else {
-            printf("Undefined variable: %s\n", token->value);
-            return ""; // Handle error: variable not found
-        }
-    }
-    printf("Invalid string value\n");
-    return "";
-}
-
 // Function to check if a variable exists
 bool variableExists(const char *name) {
-    for (int i = 0; i < numVariables; i++) {
-        if (strcasecmp(variables[i].name, name) == 0) {
-            return true;
-        }
-    }
-    return false;
+    return findVariableSlot(name) != -1;
 }
 
 // Function to add or update a variable
 void addOrUpdateVariable(const char *name, VarType type, double numValue, const char *strValue) {
-    Variable *var = findVariable(name);
-    if (var) {
-        // Update existing variable
-        var->type = type;
-        if (type == VAR_TYPE_NUMERIC) {
-            var->numValue = numValue;
-        } else {
-            strcpy(var->strValue, strValue);
-        }
-    } else {
-        // Add new variable
-        if (numVariables < MAX_VARIABLES) {
-            strcpy(variables[numVariables].name, name);
-            variables[numVariables].type = type;
-            if (type == VAR_TYPE_NUMERIC) {
-                variables[numVariables].numValue = numValue;
-            } else {
-                strcpy(variables[numVariables].strValue, strValue);
-            }
-            numVariables++;
-        } else {
-            printf("Too many variables\n");
-        }
+    Target target;
+    variableTarget(getVariableSlot(name), &target);
+    Value value = {.type = type == VAR_TYPE_STRING ? VAR_TYPE_STRING : VAR_TYPE_NUMERIC, .owned = true, .num = numValue};
+    if (value.type == VAR_TYPE_STRING) {
+        value.str = stringCopy(strValue, strlen(strValue));
     }
+    storeValue(&target, &value);
 }
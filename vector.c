@@ -0,0 +1,267 @@
+#include "cbsh.h"
+
+// Vector kernels behind MAT and the SUM/DOT reductions. Every kernel has a
+// portable scalar version and, on x86, SSE2 and AVX versions; initVectorKernels
+// picks the widest one the CPU supports. CBSH_KERNELS=scalar, sse2 or avx
+// asks for a narrower set (for testing and benchmarks).
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+// --- Scalar kernels ---
+
+static void addScalar(double *out, const double *a, const double *b, int n) {
+    for (int i = 0; i < n; i++) {
+        out[i] = a[i] + b[i];
+    }
+}
+
+static void subtractScalar(double *out, const double *a, const double *b, int n) {
+    for (int i = 0; i < n; i++) {
+        out[i] = a[i] - b[i];
+    }
+}
+
+static void scaleScalar(double *out, const double *a, double k, int n) {
+    for (int i = 0; i < n; i++) {
+        out[i] = a[i] * k;
+    }
+}
+
+static void axpyScalar(double *out, const double *a, double k, int n) {
+    for (int i = 0; i < n; i++) {
+        out[i] += a[i] * k;
+    }
+}
+
+static double sumScalar(const double *a, int n) {
+    double total = 0;
+    for (int i = 0; i < n; i++) {
+        total += a[i];
+    }
+    return total;
+}
+
+static double dotScalar(const double *a, const double *b, int n) {
+    double total = 0;
+    for (int i = 0; i < n; i++) {
+        total += a[i] * b[i];
+    }
+    return total;
+}
+
+#ifdef HAVE_X86_KERNELS
+
+// --- SSE2 kernels: two doubles at a time ---
+
+__attribute__((target("sse2")))
+static void addSse2(double *out, const double *a, const double *b, int n) {
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(out + i, _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    }
+    for (; i < n; i++) {
+        out[i] = a[i] + b[i];
+    }
+}
+
+__attribute__((target("sse2")))
+static void subtractSse2(double *out, const double *a, const double *b, int n) {
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(out + i, _mm_sub_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    }
+    for (; i < n; i++) {
+        out[i] = a[i] - b[i];
+    }
+}
+
+__attribute__((target("sse2")))
+static void scaleSse2(double *out, const double *a, double k, int n) {
+    __m128d factor = _mm_set1_pd(k);
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(a + i), factor));
+    }
+    for (; i < n; i++) {
+        out[i] = a[i] * k;
+    }
+}
+
+__attribute__((target("sse2")))
+static void axpySse2(double *out, const double *a, double k, int n) {
+    __m128d factor = _mm_set1_pd(k);
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d product = _mm_mul_pd(_mm_loadu_pd(a + i), factor);
+        _mm_storeu_pd(out + i, _mm_add_pd(_mm_loadu_pd(out + i), product));
+    }
+    for (; i < n; i++) {
+        out[i] += a[i] * k;
+    }
+}
+
+// Add the two lanes of an SSE2 register
+__attribute__((target("sse2")))
+static double lanesSse2(__m128d v) {
+    return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+__attribute__((target("sse2")))
+static double sumSse2(const double *a, int n) {
+    __m128d total0 = _mm_setzero_pd();
+    __m128d total1 = _mm_setzero_pd();
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        total0 = _mm_add_pd(total0, _mm_loadu_pd(a + i));
+        total1 = _mm_add_pd(total1, _mm_loadu_pd(a + i + 2));
+    }
+    double total = lanesSse2(_mm_add_pd(total0, total1));
+    for (; i < n; i++) {
+        total += a[i];
+    }
+    return total;
+}
+
+__attribute__((target("sse2")))
+static double dotSse2(const double *a, const double *b, int n) {
+    __m128d total0 = _mm_setzero_pd();
+    __m128d total1 = _mm_setzero_pd();
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        total0 = _mm_add_pd(total0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        total1 = _mm_add_pd(total1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+    }
+    double total = lanesSse2(_mm_add_pd(total0, total1));
+    for (; i < n; i++) {
+        total += a[i] * b[i];
+    }
+    return total;
+}
+
+// --- AVX kernels: four doubles at a time ---
+
+__attribute__((target("avx")))
+static void addAvx(double *out, const double *a, const double *b, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+    for (; i < n; i++) {
+        out[i] = a[i] + b[i];
+    }
+}
+
+__attribute__((target("avx")))
+static void subtractAvx(double *out, const double *a, const double *b, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(out + i, _mm256_sub_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+    for (; i < n; i++) {
+        out[i] = a[i] - b[i];
+    }
+}
+
+__attribute__((target("avx")))
+static void scaleAvx(double *out, const double *a, double k, int n) {
+    __m256d factor = _mm256_set1_pd(k);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), factor));
+    }
+    for (; i < n; i++) {
+        out[i] = a[i] * k;
+    }
+}
+
+__attribute__((target("avx")))
+static void axpyAvx(double *out, const double *a, double k, int n) {
+    __m256d factor = _mm256_set1_pd(k);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d product = _mm256_mul_pd(_mm256_loadu_pd(a + i), factor);
+        _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(out + i), product));
+    }
+    for (; i < n; i++) {
+        out[i] += a[i] * k;
+    }
+}
+
+// Add the four lanes of an AVX register
+__attribute__((target("avx")))
+static double lanesAvx(__m256d v) {
+    __m128d half = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+}
+
+__attribute__((target("avx")))
+static double sumAvx(const double *a, int n) {
+    __m256d total0 = _mm256_setzero_pd();
+    __m256d total1 = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        total0 = _mm256_add_pd(total0, _mm256_loadu_pd(a + i));
+        total1 = _mm256_add_pd(total1, _mm256_loadu_pd(a + i + 4));
+    }
+    double total = lanesAvx(_mm256_add_pd(total0, total1));
+    for (; i < n; i++) {
+        total += a[i];
+    }
+    return total;
+}
+
+__attribute__((target("avx")))
+static double dotAvx(const double *a, const double *b, int n) {
+    __m256d total0 = _mm256_setzero_pd();
+    __m256d total1 = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        total0 = _mm256_add_pd(total0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+        total1 = _mm256_add_pd(total1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+    }
+    double total = lanesAvx(_mm256_add_pd(total0, total1));
+    for (; i < n; i++) {
+        total += a[i] * b[i];
+    }
+    return total;
+}
+
+#endif // HAVE_X86_KERNELS
+
+static const VectorKernels scalarKernels = {
+    "scalar", addScalar, subtractScalar, scaleScalar, axpyScalar, sumScalar, dotScalar,
+};
+
+#ifdef HAVE_X86_KERNELS
+static const VectorKernels sse2Kernels = {
+    "sse2", addSse2, subtractSse2, scaleSse2, axpySse2, sumSse2, dotSse2,
+};
+
+static const VectorKernels avxKernels = {
+    "avx", addAvx, subtractAvx, scaleAvx, axpyAvx, sumAvx, dotAvx,
+};
+#endif
+
+VectorKernels vectorKernels = {
+    "scalar", addScalar, subtractScalar, scaleScalar, axpyScalar, sumScalar, dotScalar,
+};
+
+// Pick the widest kernels the CPU supports, or the ones CBSH_KERNELS names
+void initVectorKernels() {
+    const char *wanted = getenv("CBSH_KERNELS");
+    vectorKernels = scalarKernels;
+    if (wanted && strcasecmp(wanted, "scalar") == 0) {
+        return;
+    }
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx") && !(wanted && strcasecmp(wanted, "sse2") == 0)) {
+        vectorKernels = avxKernels;
+    } else if (__builtin_cpu_supports("sse2")) {
+        vectorKernels = sse2Kernels;
+    }
+#endif
+}
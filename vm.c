@@ -0,0 +1,531 @@
+#include "cbsh.h"
+
+// Bytecode VM used by RUN. The program is compiled once into a flat array of
+// instructions with variable slots, jump targets and compiled expressions
+// already resolved, then run by a threaded dispatch loop. Statements the
+// compiler has no instruction for become VM_EXEC, which hands their tokens
+// to the tree-walking executor, so the two paths always agree.
+
+bool useBytecode = true; // SET BYTECODE = FALSE runs the tree-walker instead
+
+typedef enum {
+    VM_LET,       // numeric variable arg = expr
+    VM_STORE,     // target = expr: a string or integer variable arg, or an array element
+    VM_IF_FALSE,  // if expr is false, jump to arg
+    VM_GOTO,      // jump to arg
+    VM_GOSUB,     // push the next statement, jump to arg
+    VM_RETURN,    // pop a position from the GOSUB stack
+    VM_FOR,       // variable arg = expr, push a loop frame up to limit by step
+    VM_NEXT,      // step the loop of variable arg (-1: innermost), jump back if not done
+    VM_EXEC,      // run tokens through executeStatement()
+    VM_END        // stop
+} VmOp;
+
+typedef struct {
+    VmOp op;
+    int line; // Program index this instruction came from
+    int statement; // Statement within that line
+    int arg; // Slot or jump target (a line index until linked, then a pc)
+    Expr *expr;
+    Expr *limit; // VM_FOR
+    Expr *step; // VM_FOR, NULL for STEP 1
+    Expr *target; // VM_STORE to an element: its subscripts and one OP_ELEMENT
+    Token *tokens; // VM_EXEC statement
+    int numTokens;
+} VmInstr;
+
+static VmInstr *code = NULL;
+static int codeLength = 0;
+static int codeCapacity = 0;
+static int *statementPc = NULL; // pc of each statement, each line followed by the pc of the next line
+static int *lineFirst = NULL; // Index in statementPc of each line's first statement, plus one for the end
+static Expr **ownedExprs = NULL; // Expressions compiled for this bytecode
+static int numOwnedExprs = 0;
+static int ownedExprsCapacity = 0;
+static unsigned int compiledProgram = 0;
+static unsigned int compiledSymbols = 0;
+
+// Append an instruction for the given statement
+static VmInstr *emitInstr(VmOp op, int line, int statement) {
+    if (codeLength == codeCapacity) {
+        int newCapacity = codeCapacity ? codeCapacity * 2 : 256;
+        VmInstr *newCode = realloc(code, newCapacity * sizeof(VmInstr));
+        if (!newCode) {
+            perror("realloc");
+            exit(1);
+        }
+        code = newCode;
+        codeCapacity = newCapacity;
+    }
+    VmInstr *instr = &code[codeLength++];
+    memset(instr, 0, sizeof(VmInstr));
+    instr->op = op;
+    instr->line = line;
+    instr->statement = statement;
+    return instr;
+}
+
+// Keep an expression compiled for this bytecode, to be freed with it
+static Expr *ownExpr(Expr *expr) {
+    if (numOwnedExprs == ownedExprsCapacity) {
+        int newCapacity = ownedExprsCapacity ? ownedExprsCapacity * 2 : 256;
+        Expr **newExprs = realloc(ownedExprs, newCapacity * sizeof(Expr *));
+        if (!newExprs) {
+            perror("realloc");
+            exit(1);
+        }
+        ownedExprs = newExprs;
+        ownedExprsCapacity = newCapacity;
+    }
+    ownedExprs[numOwnedExprs++] = expr;
+    return expr;
+}
+
+// Compile an expression that must span all the tokens, quietly. NULL if it can't.
+static Expr *compileOperand(Token *tokens, int numTokens) {
+    if (numTokens <= 0) {
+        return NULL;
+    }
+    Expr *expr = compileExpression(tokens, numTokens, false);
+    if (!expr) {
+        return NULL;
+    }
+    if (expr->consumed != numTokens) {
+        free(expr);
+        return NULL;
+    }
+    return ownExpr(expr);
+}
+
+// Hand a statement to the tree-walker
+static void emitExec(Token *tokens, int numTokens, int line, int statement) {
+    VmInstr *instr = emitInstr(VM_EXEC, line, statement);
+    instr->tokens = tokens;
+    instr->numTokens = numTokens;
+}
+
+// Emit a jump to a line number token; falls back if the line does not exist
+static void emitJump(VmOp op, Token *tokens, int numTokens, int line, int statement) {
+    int target = numTokens >= 2 && tokens[1].type == TOKEN_NUMBER ? resolveJumpTarget(&tokens[1]) : -1;
+    if (target == -1) {
+        emitExec(tokens, numTokens, line, statement); // Reports the error when reached
+        return;
+    }
+    emitInstr(op, line, statement)->arg = target;
+}
+
+// Compile one statement
+static void compileStatement(Token *tokens, int numTokens, int line, int statement) {
+    if (numTokens == 0) {
+        return;
+    }
+
+    switch (tokens[0].keyword) {
+        case KW_REM:
+        case KW_DATA: // Collected before the program runs
+            return;
+        case KW_GOTO:
+            emitJump(VM_GOTO, tokens, numTokens, line, statement);
+            return;
+        case KW_GOSUB:
+            emitJump(VM_GOSUB, tokens, numTokens, line, statement);
+            return;
+        case KW_RETURN:
+            emitInstr(VM_RETURN, line, statement);
+            return;
+        case KW_END:
+            emitInstr(VM_END, line, statement);
+            return;
+        case KW_IF: {
+            int thenIndex = -1;
+            for (int i = 1; i < numTokens; i++) {
+                if (tokens[i].keyword == KW_THEN) {
+                    thenIndex = i;
+                    break;
+                }
+            }
+            Expr *condition = thenIndex > 1 ? compileOperand(tokens + 1, thenIndex - 1) : NULL;
+            if (!condition) {
+                break;
+            }
+            VmInstr *test = emitInstr(VM_IF_FALSE, line, statement);
+            test->expr = condition;
+            test->arg = line + 1; // A false IF skips the rest of the line
+            Token *rest = tokens + thenIndex + 1;
+            int numRest = numTokens - thenIndex - 1;
+            if (numRest == 1 && rest[0].type == TOKEN_NUMBER) {
+                // IF ... THEN <line> is IF ... THEN GOTO <line>
+                emitJump(VM_GOTO, rest - 1, 2, line, statement);
+            } else {
+                compileStatement(rest, numRest, line, statement);
+            }
+            return;
+        }
+        case KW_FOR: {
+            int toIndex, stepIndex;
+            if (!splitForStatement(tokens, numTokens, &toIndex, &stepIndex) || tokens[0].target == -1 ||
+                tokens[1].slot < 0 || variableInfo[tokens[1].slot].type != VAR_TYPE_NUMERIC) {
+                break;
+            }
+            Expr *start = compileOperand(tokens + 3, toIndex - 3);
+            Expr *limit = compileOperand(tokens + toIndex + 1, stepIndex - toIndex - 1);
+            Expr *step = NULL;
+            if (stepIndex < numTokens) {
+                step = compileOperand(tokens + stepIndex + 1, numTokens - stepIndex - 1);
+                if (!step) {
+                    break;
+                }
+            }
+            if (!start || !limit) {
+                break;
+            }
+            VmInstr *instr = emitInstr(VM_FOR, line, statement);
+            instr->arg = tokens[1].slot;
+            instr->expr = start;
+            instr->limit = limit;
+            instr->step = step;
+            return;
+        }
+        case KW_NEXT: {
+            if (numTokens == 1) {
+                emitInstr(VM_NEXT, line, statement)->arg = -1;
+                return;
+            }
+            // NEXT A, B: one instruction per variable; each falls through when its loop ends
+            for (int i = 1; i < numTokens; i++) {
+                if ((i % 2 == 1 && (tokens[i].type != TOKEN_IDENTIFIER || tokens[i].slot < 0)) ||
+                    (i % 2 == 0 && strcmp(tokens[i].value, ",") != 0)) {
+                    emitExec(tokens, numTokens, line, statement);
+                    return;
+                }
+            }
+            for (int i = 1; i < numTokens; i += 2) {
+                emitInstr(VM_NEXT, line, statement)->arg = tokens[i].slot;
+            }
+            return;
+        }
+        case KW_LET:
+        case KW_NONE: {
+            Token *target = &tokens[tokens[0].keyword == KW_LET ? 1 : 0];
+            if (target->type != TOKEN_IDENTIFIER || target->slot < 0) {
+                break;
+            }
+            Expr *element = NULL;
+            int assign = target - tokens + 1;
+            if (assign < numTokens && tokens[assign].type == TOKEN_OPERATOR && strcmp(tokens[assign].value, "(") == 0) {
+                element = compileTarget(target, numTokens - (assign - 1), false);
+                if (!element) {
+                    break;
+                }
+                ownExpr(element);
+                assign += element->consumed - 1;
+            }
+            if (assign >= numTokens || tokens[assign].type != TOKEN_OPERATOR || strcmp(tokens[assign].value, "=") != 0) {
+                break;
+            }
+            Expr *value = compileOperand(tokens + assign + 1, numTokens - assign - 1);
+            if (!value) {
+                break;
+            }
+            bool numeric = !element && variableInfo[target->slot].type == VAR_TYPE_NUMERIC;
+            VmInstr *instr = emitInstr(numeric ? VM_LET : VM_STORE, line, statement);
+            instr->arg = target->slot;
+            instr->expr = value;
+            instr->target = element;
+            return;
+        }
+        default:
+            break;
+    }
+    emitExec(tokens, numTokens, line, statement);
+}
+
+// Compile the whole program, unless the current bytecode is still valid
+static void compileProgram() {
+    if (compiledProgram == programGeneration && compiledSymbols == symbolGeneration && code) {
+        return;
+    }
+
+    for (int i = 0; i < numOwnedExprs; i++) {
+        free(ownedExprs[i]);
+    }
+    numOwnedExprs = 0;
+    codeLength = 0;
+    int numEntries = 1;
+    for (int i = 0; i < numLines; i++) {
+        numEntries += program[i]->numStatements + 1;
+    }
+    free(statementPc);
+    free(lineFirst);
+    statementPc = malloc(numEntries * sizeof(int));
+    lineFirst = malloc((numLines + 1) * sizeof(int));
+    if (!statementPc || !lineFirst) {
+        perror("malloc");
+        exit(1);
+    }
+
+    int entry = 0;
+    for (int i = 0; i < numLines; i++) {
+        Line *line = program[i];
+        lineFirst[i] = entry;
+        for (int s = 0; s < line->numStatements; s++) {
+            statementPc[entry++] = codeLength;
+            int start = line->statements[s];
+            compileStatement(line->tokens + start, line->statements[s + 1] - start - 1, i, s);
+        }
+        statementPc[entry++] = codeLength; // Running off the end of the line
+    }
+    lineFirst[numLines] = entry;
+    statementPc[entry] = codeLength;
+    emitInstr(VM_END, numLines, 0);
+
+    // Link: jump targets were recorded as line indices
+    for (int pc = 0; pc < codeLength; pc++) {
+        VmOp op = code[pc].op;
+        if (op == VM_GOTO || op == VM_GOSUB || op == VM_IF_FALSE) {
+            code[pc].arg = statementPc[lineFirst[code[pc].arg]];
+        }
+    }
+
+    compiledProgram = programGeneration;
+    compiledSymbols = symbolGeneration;
+}
+
+// Evaluate a numeric expression. Returns false (after reporting) on an error.
+static bool evaluateNumber(Expr *expr, double *result) {
+    Value value;
+    if (!evaluateCompiled(expr, &value)) {
+        return false;
+    }
+    if (value.type != VAR_TYPE_NUMERIC) {
+        outPrintf("Type mismatch\n");
+        releaseValue(&value);
+        return false;
+    }
+    *result = value.num;
+    return true;
+}
+
+// Instruction a position starts at, or NULL (with nextLine/nextStatement
+// set) when the position is on the direct line, which the VM cannot run
+static VmInstr *resumeAt(int line, int statement) {
+    if (line == DIRECT_LINE) {
+        nextLine = line;
+        nextStatement = statement;
+        return NULL;
+    }
+    if (line >= numLines) {
+        return &code[statementPc[lineFirst[numLines]]];
+    }
+    if (statement > program[line]->numStatements) {
+        statement = program[line]->numStatements;
+    }
+    return &code[statementPc[lineFirst[line] + statement]];
+}
+
+// Run the program from a position using the bytecode. Returns with running
+// cleared at END or the end of the program, or with it still set when
+// control passes back to the direct line (a RETURN or NEXT that belongs to it).
+void runBytecode(int line, int statement) {
+    compileProgram();
+
+    VmInstr *instr = resumeAt(line, statement);
+    Value value;
+
+#if defined(__GNUC__)
+    // Threaded dispatch: jump straight from one handler to the next
+    static void *dispatch[] = {
+        [VM_LET] = &&op_let, [VM_STORE] = &&op_store, [VM_IF_FALSE] = &&op_if_false, [VM_GOTO] = &&op_goto,
+        [VM_GOSUB] = &&op_gosub, [VM_RETURN] = &&op_return, [VM_FOR] = &&op_for,
+        [VM_NEXT] = &&op_next, [VM_EXEC] = &&op_exec, [VM_END] = &&op_end,
+    };
+    // While statements are counted or profiled, every instruction passes through op_count first
+    static void *countDispatch[VM_END + 1];
+    if (!countDispatch[VM_END]) {
+        for (int op = 0; op <= VM_END; op++) {
+            countDispatch[op] = &&op_count;
+        }
+    }
+    void **handlers = profiling || statsEnabled ? countDispatch : dispatch;
+#define NEXT() goto *handlers[instr->op]
+#define DISPATCH() goto *dispatch[instr->op]
+#else
+#define NEXT() goto dispatch_count
+#define DISPATCH() goto dispatch_switch
+dispatch_count:
+    if (profiling || statsEnabled) {
+        goto op_count;
+    }
+dispatch_switch:
+    switch (instr->op) {
+        case VM_LET: goto op_let;
+        case VM_STORE: goto op_store;
+        case VM_IF_FALSE: goto op_if_false;
+        case VM_GOTO: goto op_goto;
+        case VM_GOSUB: goto op_gosub;
+        case VM_RETURN: goto op_return;
+        case VM_FOR: goto op_for;
+        case VM_NEXT: goto op_next;
+        case VM_EXEC: goto op_exec;
+        case VM_END: goto op_end;
+    }
+#endif
+    NEXT();
+
+op_count:
+    // Count a statement when control reaches its first instruction
+    if (instr->line < numLines && instr == &code[statementPc[lineFirst[instr->line] + instr->statement]]) {
+        countStatement(instr->line, instr->statement);
+    }
+    DISPATCH();
+
+op_let:
+    if (evaluateCompiled(instr->expr, &value)) {
+        if (value.type != VAR_TYPE_NUMERIC) {
+            outPrintf("Type mismatch\n");
+            releaseValue(&value);
+        } else {
+            numValues[instr->arg] = value.num;
+        }
+    }
+    instr++;
+    NEXT();
+
+op_store: {
+        Target target;
+        if (evaluateCompiled(instr->expr, &value)) {
+            if (!instr->target) {
+                variableTarget(instr->arg, &target);
+                storeValue(&target, &value);
+            } else if (evaluateTarget(instr->target, &target)) {
+                storeValue(&target, &value);
+            } else {
+                releaseValue(&value);
+            }
+        }
+        instr++;
+        NEXT();
+    }
+
+op_if_false:
+    if (!evaluateNumber(instr->expr, &value.num) || value.num == 0) {
+        instr = &code[instr->arg];
+    } else {
+        instr++;
+    }
+    NEXT();
+
+op_goto:
+    instr = &code[instr->arg];
+    NEXT();
+
+op_gosub:
+    if (gosubStackPtr < MAX_GOSUB_STACK) {
+        gosubStack[gosubStackPtr].returnLine = instr->line;
+        gosubStack[gosubStackPtr].returnStatement = instr->statement + 1;
+        gosubStack[gosubStackPtr++].loopDepth = loopStackPtr;
+        if ((uint64_t)gosubStackPtr > stats.gosubHighWater) {
+            stats.gosubHighWater = gosubStackPtr;
+        }
+        instr = &code[instr->arg];
+    } else {
+        outPrintf("GOSUB stack overflow\n");
+        instr++;
+    }
+    NEXT();
+
+op_return:
+    if (gosubStackPtr > 0) {
+        gosubStackPtr--;
+        loopStackPtr = gosubStack[gosubStackPtr].loopDepth;
+        instr = resumeAt(gosubStack[gosubStackPtr].returnLine, gosubStack[gosubStackPtr].returnStatement);
+        if (!instr) {
+            return;
+        }
+    } else {
+        outPrintf("RETURN without GOSUB\n");
+        instr++;
+    }
+    NEXT();
+
+op_for: {
+        double start = 0, limit = 0, step = 1;
+        evaluateNumber(instr->expr, &start);
+        evaluateNumber(instr->limit, &limit);
+        if (instr->step) {
+            evaluateNumber(instr->step, &step);
+        }
+        numValues[instr->arg] = start;
+        pushLoop(instr->arg, limit, step, instr->line, instr->statement);
+        instr++;
+        NEXT();
+    }
+
+op_next: {
+        // Innermost loop on the stack is the common case: increment, compare, branch
+        if (loopStackPtr > 0 && (instr->arg == -1 || loopStack[loopStackPtr - 1].slot == instr->arg)) {
+            LoopFrame *frame = &loopStack[loopStackPtr - 1];
+            double *counter = &numValues[frame->slot];
+            *counter += frame->step;
+            if ((frame->step > 0 && *counter > frame->end) || (frame->step < 0 && *counter < frame->end)) {
+                loopStackPtr--;
+                instr++;
+            } else if (frame->line != DIRECT_LINE) {
+                instr = &code[statementPc[lineFirst[frame->line] + frame->statement + 1]];
+            } else {
+                resumeAt(frame->line, frame->statement + 1);
+                return;
+            }
+            NEXT();
+        }
+        int frame = stepLoop(instr->arg);
+        if (frame >= 0) {
+            instr = resumeAt(loopStack[frame].line, loopStack[frame].statement + 1);
+            if (!instr) {
+                return;
+            }
+        } else if (frame == LOOP_MISSING) {
+            // Skip the rest of a NEXT A, B list, as the tree-walker does
+            VmInstr *next = instr;
+            while (next->op == VM_NEXT && next->line == instr->line && next->statement == instr->statement) {
+                next++;
+            }
+            instr = next;
+        } else {
+            instr++;
+        }
+        NEXT();
+    }
+
+op_exec: {
+        // The tree-walker reports jumps through nextLine
+        currentLine = instr->line;
+        currentStatement = instr->statement;
+        nextLine = instr->line;
+        nextStatement = instr->statement + 1;
+        executeStatement(instr->tokens, instr->numTokens);
+        if (!running) {
+            goto op_end;
+        }
+#if defined(__GNUC__)
+        handlers = profiling || statsEnabled ? countDispatch : dispatch; // SET STATS may have changed
+#endif
+        if (nextLine != instr->line || nextStatement != instr->statement + 1) {
+            instr = resumeAt(nextLine, nextStatement);
+            if (!instr) {
+                return;
+            }
+        } else {
+            instr++;
+        }
+        NEXT();
+    }
+
+op_end:
+    running = false;
+    outFlush(); // As executeEnd does, so output comes before anything run next
+    return;
+
+#undef NEXT
+#undef DISPATCH
+}